@@ -0,0 +1,165 @@
+// Benchmark of connection matrix layouts.
+//
+// Parses the sentences of FILE with the dictionary in DICDIR, records
+// every (right node, left node) lookup connect() makes, and replays
+// them against three layouts of matrix.bin:
+//
+//   row        the layout of matrix.bin (a row per right node)
+//   aligned    rows padded to start at 64-byte boundaries (--align-matrix)
+//   transposed a column per right node, i.e. the left nodes stride by
+//              a whole row
+//
+// Usage: matrix_bench DICDIR FILE [row|aligned|transposed]
+//
+// Give a single layout to compare cache misses with, for example,
+//   perf stat -e L1-dcache-load-misses,LLC-load-misses \
+//     matrix_bench DICDIR FILE transposed
+//
+// g++ -O2 matrix_bench.cpp -o matrix_bench `mecab-config --libs`
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mecab.h>
+
+namespace {
+
+// Lookups of one connect() call: a right node against all left nodes.
+struct Access {
+  unsigned short lcAttr;
+  size_t begin;   // into rcAttrs
+  size_t size;
+};
+
+const size_t kLineSize = 64 / sizeof(short);
+const int kRepeat = 20;
+
+long replay(const std::vector<Access> &trace,
+            const std::vector<unsigned short> &rcAttrs,
+            const short *matrix, size_t lstride, size_t rstride) {
+  long sum = 0;
+  for (int n = 0; n < kRepeat; ++n) {
+    for (size_t i = 0; i < trace.size(); ++i) {
+      const short *row = matrix + rstride * trace[i].lcAttr;
+      const unsigned short *rc = &rcAttrs[trace[i].begin];
+      int best = 32767;
+      for (size_t j = 0; j < trace[i].size; ++j) {
+        const int c = row[lstride * rc[j]];
+        if (c < best) best = c;
+      }
+      sum += best;
+    }
+  }
+  return sum;
+}
+
+void run(const char *name,
+         const std::vector<Access> &trace,
+         const std::vector<unsigned short> &rcAttrs,
+         size_t accesses,
+         const short *matrix, size_t lstride, size_t rstride) {
+  const clock_t start = clock();
+  const long sum = replay(trace, rcAttrs, matrix, lstride, rstride);
+  const double sec = static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+  std::printf("%-10s %8.3f sec %8.3f ns/lookup (checksum %ld)\n",
+              name, sec, 1e9 * sec / (accesses * kRepeat), sum);
+}
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0]
+              << " DICDIR FILE [row|aligned|transposed]" << std::endl;
+    return -1;
+  }
+  const std::string dicdir = argv[1];
+  const std::string layout = argc >= 4 ? argv[3] : "";
+
+  std::ifstream mfs((dicdir + "/matrix.bin").c_str(), std::ios::binary);
+  unsigned short lsize = 0, rsize = 0;
+  mfs.read(reinterpret_cast<char *>(&lsize), sizeof(lsize));
+  mfs.read(reinterpret_cast<char *>(&rsize), sizeof(rsize));
+  std::vector<short> row(lsize * rsize);
+  mfs.read(reinterpret_cast<char *>(&row[0]), sizeof(short) * row.size());
+  if (!mfs) {
+    std::cerr << "cannot read " << dicdir << "/matrix.bin" << std::endl;
+    return -1;
+  }
+
+  const std::string arg = "-d " + dicdir;
+  MeCab::Model *model = MeCab::createModel(arg.c_str());
+  if (!model) {
+    std::cerr << MeCab::getLastError() << std::endl;
+    return -1;
+  }
+  MeCab::Tagger *tagger = model->createTagger();
+  MeCab::Lattice *lattice = model->createLattice();
+
+  std::vector<Access> trace;
+  std::vector<unsigned short> rcAttrs;
+  size_t accesses = 0;
+  std::ifstream ifs(argv[2]);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    lattice->set_sentence(line.c_str());
+    if (!tagger->parse(lattice)) {
+      continue;
+    }
+    for (size_t pos = 0; pos <= lattice->size(); ++pos) {
+      for (const MeCab::Node *rnode = lattice->begin_nodes(pos);
+           rnode; rnode = rnode->bnext) {
+        Access access;
+        access.lcAttr = rnode->lcAttr;
+        access.begin = rcAttrs.size();
+        for (const MeCab::Node *lnode = lattice->end_nodes(pos);
+             lnode; lnode = lnode->enext) {
+          rcAttrs.push_back(lnode->rcAttr);
+        }
+        access.size = rcAttrs.size() - access.begin;
+        accesses += access.size;
+        if (access.size) {
+          trace.push_back(access);
+        }
+      }
+    }
+  }
+
+  std::vector<short> transposed(lsize * rsize);
+  for (size_t l = 0; l < rsize; ++l) {
+    for (size_t r = 0; r < lsize; ++r) {
+      transposed[l + rsize * r] = row[r + lsize * l];
+    }
+  }
+
+  const size_t stride = (lsize + kLineSize - 1) / kLineSize * kLineSize;
+  std::vector<short> aligned_buf(stride * rsize + 2 * kLineSize);
+  short *aligned = &aligned_buf[kLineSize];
+  aligned += (kLineSize - reinterpret_cast<size_t>(aligned) / sizeof(short)
+              % kLineSize) % kLineSize;
+  for (size_t l = 0; l < rsize; ++l) {
+    std::memcpy(aligned + stride * l, &row[lsize * l], sizeof(short) * lsize);
+  }
+
+  std::printf("matrix %dx%d, %lu connect() calls, %lu lookups\n",
+              lsize, rsize, static_cast<unsigned long>(trace.size()),
+              static_cast<unsigned long>(accesses));
+
+  if (layout.empty() || layout == "row") {
+    run("row", trace, rcAttrs, accesses, &row[0], 1, lsize);
+  }
+  if (layout.empty() || layout == "aligned") {
+    run("aligned", trace, rcAttrs, accesses, aligned, 1, stride);
+  }
+  if (layout.empty() || layout == "transposed") {
+    run("transposed", trace, rcAttrs, accesses, &transposed[0], rsize, 1);
+  }
+
+  delete lattice;
+  delete tagger;
+  delete model;
+
+  return 0;
+}
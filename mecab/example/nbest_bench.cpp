@@ -0,0 +1,233 @@
+// Benchmark of n-best enumeration.
+//
+// Parses the sentences of FILE with the dictionary in DICDIR and
+// enumerates the N best paths of each lattice by A* search from EOS in
+// two ways:
+//
+//   eager  a popped element pushes every left path of its node, as
+//          NBestGenerator did before
+//   lazy   the left paths of a node are sorted when it is first
+//          expanded, and a popped element pushes only its best
+//          extension and its next sibling, as NBestGenerator does now
+//
+// and prints the time, the elements pushed and the largest agenda of
+// each. The costs of the paths found are checked against the ones of
+// Lattice::next(), whose time is printed as "library" (with the walk
+// summing the costs of each path).
+//
+// Usage: nbest_bench DICDIR FILE [N]
+//
+// g++ -O2 nbest_bench.cpp -o nbest_bench `mecab-config --libs`
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <vector>
+#include <mecab.h>
+
+namespace {
+
+struct Element {
+  const MeCab::Node *node;
+  long parent;        // index of the parent element, -1 for EOS
+  long fx;
+  long gx;
+  size_t index;       // of the path in the sorted list of the parent
+};
+
+struct Stat {
+  const char *name;
+  double sec;
+  size_t pushed;
+  size_t max_agenda;
+  Stat(const char *n) : name(n), sec(0.0), pushed(0), max_agenda(0) {}
+};
+
+class ElementComp {
+ public:
+  explicit ElementComp(const std::deque<Element> *e) : elements_(e) {}
+  bool operator()(long i, long j) const {
+    return (*elements_)[i].fx > (*elements_)[j].fx;
+  }
+ private:
+  const std::deque<Element> *elements_;
+};
+
+typedef std::priority_queue<long, std::vector<long>, ElementComp> Agenda;
+
+void push(std::deque<Element> *elements, Agenda *agenda, Stat *stat,
+          const MeCab::Path *path, long parent, size_t index) {
+  const Element &p = (*elements)[parent];
+  Element e;
+  e.node = path->lnode;
+  e.parent = parent;
+  e.gx = path->cost + p.gx;
+  e.fx = path->lnode->cost + path->cost + p.gx;
+  e.index = index;
+  elements->push_back(e);
+  agenda->push(elements->size() - 1);
+  ++stat->pushed;
+  stat->max_agenda = std::max(stat->max_agenda, agenda->size());
+}
+
+bool path_less(const MeCab::Path *path1, const MeCab::Path *path2) {
+  return path1->lnode->cost + path1->cost <
+      path2->lnode->cost + path2->cost;
+}
+
+// Appends the costs of the |n| best paths to |costs|.
+void enumerate(const MeCab::Lattice *lattice, size_t n, bool lazy,
+               std::vector<long> *costs, Stat *stat) {
+  const clock_t start = clock();
+  std::deque<Element> elements;
+  Agenda agenda((ElementComp(&elements)));
+  // the sorted left paths of a node by its id, for the lazy search.
+  std::vector<std::vector<const MeCab::Path *> > sorted;
+  std::vector<bool> is_sorted;
+
+  Element eos;
+  eos.node = lattice->eos_node();
+  eos.parent = -1;
+  eos.fx = eos.gx = 0;
+  eos.index = 0;
+  elements.push_back(eos);
+  agenda.push(0);
+
+  while (!agenda.empty() && n > 0) {
+    const long top = agenda.top();
+    agenda.pop();
+    const MeCab::Node *rnode = elements[top].node;
+
+    if (lazy) {
+      const long parent = elements[top].parent;
+      const size_t index = elements[top].index + 1;
+      if (parent >= 0 && index < sorted[elements[parent].node->id].size()) {
+        push(&elements, &agenda, stat,
+             sorted[elements[parent].node->id][index], parent, index);
+      }
+    }
+
+    if (rnode->stat == MECAB_BOS_NODE) {
+      costs->push_back(elements[top].gx);
+      --n;
+      continue;
+    }
+
+    if (lazy) {
+      if (rnode->id >= sorted.size()) {
+        sorted.resize(rnode->id + 1);
+        is_sorted.resize(rnode->id + 1, false);
+      }
+      std::vector<const MeCab::Path *> &paths = sorted[rnode->id];
+      if (!is_sorted[rnode->id]) {
+        for (const MeCab::Path *path = rnode->lpath; path;
+             path = path->lnext) {
+          paths.push_back(path);
+        }
+        std::stable_sort(paths.begin(), paths.end(), path_less);
+        is_sorted[rnode->id] = true;
+      }
+      if (!paths.empty()) {
+        push(&elements, &agenda, stat, paths[0], top, 0);
+      }
+    } else {
+      for (const MeCab::Path *path = rnode->lpath; path;
+           path = path->lnext) {
+        push(&elements, &agenda, stat, path, top, 0);
+      }
+    }
+  }
+
+  stat->sec += static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// the cost of the path from BOS to EOS through Node::next.
+long path_cost(const MeCab::Lattice *lattice) {
+  long cost = 0;
+  for (const MeCab::Node *node = lattice->bos_node(); node->next;
+       node = node->next) {
+    for (const MeCab::Path *path = node->next->lpath; path;
+         path = path->lnext) {
+      if (path->lnode == node) {
+        cost += path->cost;
+        break;
+      }
+    }
+  }
+  return cost;
+}
+
+void print(const Stat &stat) {
+  std::printf("%-8s %8.3f sec", stat.name, stat.sec);
+  if (stat.pushed) {
+    std::printf(" %12lu pushed %10lu max agenda",
+                static_cast<unsigned long>(stat.pushed),
+                static_cast<unsigned long>(stat.max_agenda));
+  }
+  std::printf("\n");
+}
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " DICDIR FILE [N]" << std::endl;
+    return -1;
+  }
+  const std::string arg = std::string("-d ") + argv[1];
+  const size_t n = argc >= 4 ? std::atoi(argv[3]) : 20;
+
+  MeCab::Model *model = MeCab::createModel(arg.c_str());
+  if (!model) {
+    std::cerr << MeCab::getLastError() << std::endl;
+    return -1;
+  }
+  MeCab::Tagger *tagger = model->createTagger();
+  MeCab::Lattice *lattice = model->createLattice();
+
+  Stat library("library"), eager("eager"), lazy("lazy");
+  size_t sentences = 0;
+  size_t mismatches = 0;
+  std::ifstream ifs(argv[2]);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    lattice->set_sentence(line.c_str());
+    lattice->set_request_type(MECAB_NBEST);
+    if (!tagger->parse(lattice)) {
+      continue;
+    }
+    ++sentences;
+
+    std::vector<long> expected;
+    const clock_t start = clock();
+    for (size_t i = 0; i < n && lattice->next(); ++i) {
+      expected.push_back(path_cost(lattice));
+    }
+    library.sec += static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+
+    std::vector<long> eager_costs, lazy_costs;
+    enumerate(lattice, n, false, &eager_costs, &eager);
+    enumerate(lattice, n, true, &lazy_costs, &lazy);
+    if (eager_costs != expected || lazy_costs != expected) {
+      ++mismatches;
+    }
+  }
+
+  std::printf("%lu sentences, %lu best, %lu mismatches\n",
+              static_cast<unsigned long>(sentences),
+              static_cast<unsigned long>(n),
+              static_cast<unsigned long>(mismatches));
+  print(library);
+  print(eager);
+  print(lazy);
+
+  delete lattice;
+  delete tagger;
+  delete model;
+
+  return mismatches == 0 ? 0 : 1;
+}
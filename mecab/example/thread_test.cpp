@@ -11,14 +11,18 @@ namespace MeCab {
 class TaggerThread : public thread {
  public:
   void run() {
+    // The slot is created by this thread, so that its memory is
+    // allocated on the NUMA node the thread runs on.
+    MeCab::Tagger *tagger = pool_->tagger(id_);
+    MeCab::Lattice *lattice = pool_->lattice(id_);
     int n = 0;
     while (true) {
       for (size_t i = 0; i < sentences_->size(); ++i) {
-        lattice_->set_sentence((*sentences_)[i].c_str());
-        tagger_->parse(lattice_);
+        lattice->set_sentence((*sentences_)[i].c_str());
+        tagger->parse(lattice);
         if (n % 100141 == 0) {
           std::cout << id_ << " " << n << " parsed" << std::endl;
-//	  std::cout << lattice_->toString();
+//	  std::cout << lattice->toString();
         }
         ++n;
       }
@@ -26,22 +30,13 @@ class TaggerThread : public thread {
   }
 
   TaggerThread(std::vector<std::string> *sentences,
-               MeCab::Model *model,
+               MeCab::TaggerPool *pool,
                int id)
-      : sentences_(sentences), tagger_(0), id_(id) {
-    tagger_ = model->createTagger();
-    lattice_ = model->createLattice();
-  }
-
-  ~TaggerThread() {
-    delete tagger_;
-    delete lattice_;
-  }
+      : sentences_(sentences), pool_(pool), id_(id) {}
 
  private:
   std::vector<std::string> *sentences_;
-  MeCab::Tagger *tagger_;
-  MeCab::Lattice *lattice_;
+  MeCab::TaggerPool *pool_;
   int id_;
 };
 
@@ -106,9 +101,10 @@ int main (int argc, char **argv) {
 
   const int kMaxThreadSize = 8;
 
+  MeCab::TaggerPool *pool = model->createPool(kMaxThreadSize);
   std::vector<MeCab::TaggerThread *> threads(kMaxThreadSize);
   for (int i = 0; i < kMaxThreadSize; ++i) {
-    threads[i] = new MeCab::TaggerThread(&sentences, model, i);
+    threads[i] = new MeCab::TaggerThread(&sentences, pool, i);
   }
 
   for (int i = 0; i < kMaxThreadSize; ++i) {
@@ -121,7 +117,8 @@ int main (int argc, char **argv) {
   }
 
   updater.join();
-   
+
+  delete pool;
   delete model;
 
   return 0;
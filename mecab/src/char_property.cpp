@@ -10,6 +10,7 @@
 #include <sstream>
 #include "char_property.h"
 #include "common.h"
+#include "dictionary.h"
 #include "mmap.h"
 #include "param.h"
 #include "utils.h"
@@ -71,16 +72,26 @@ CharInfo encode(const std::vector<std::string> &c,
 }
 }
 
-bool CharProperty::open(const Param &param) {
+bool CharProperty::open(const Param &param, const Bundle *bundle) {
   const std::string prefix   = param.get<std::string>("dicdir");
   const std::string filename = create_filename(prefix, CHAR_PROPERTY_FILE);
-  return open(filename.c_str());
+  if (!bundle) {
+    return open(filename.c_str(), dictionary_mode(param).c_str());
+  }
+  const char *ptr = 0;
+  size_t size = 0;
+  CHECK_FALSE(bundle->find(CHAR_PROPERTY_FILE, &ptr, &size))
+      << "no such section: " << filename;
+  cmmap_->attach(filename.c_str(), const_cast<char *>(ptr), size);
+  return init(filename.c_str());
 }
 
-bool CharProperty::open(const char *filename) {
-  std::ostringstream error;
-  CHECK_FALSE(cmmap_->open(filename, "r"));
+bool CharProperty::open(const char *filename, const char *mode) {
+  CHECK_FALSE(cmmap_->open(filename, mode));
+  return init(filename);
+}
 
+bool CharProperty::init(const char *filename) {
   const char *ptr = cmmap_->begin();
   unsigned int csize;
   read_static<unsigned int>(&ptr, csize);
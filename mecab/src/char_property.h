@@ -12,6 +12,7 @@
 
 namespace MeCab {
 class Param;
+class Bundle;
 
 struct CharInfo {
   unsigned int type:         18;
@@ -25,8 +26,9 @@ struct CharInfo {
 
 class CharProperty {
  public:
-  bool open(const Param &);
-  bool open(const char*);
+  // reads char.bin from |bundle| when given, from dicdir otherwise.
+  bool open(const Param &, const Bundle *bundle = 0);
+  bool open(const char *filename, const char *mode = "r");
   void close();
   size_t size() const;
   void set_charset(const char *charset);
@@ -34,6 +36,10 @@ class CharProperty {
   const char *name(size_t i) const;
   const char *what() { return what_.str(); }
 
+  // memory holding char.bin.
+  const char *data() const { return cmmap_->begin(); }
+  size_t data_size() const { return cmmap_->file_size(); }
+
   inline const char *seekToOtherType(const char *begin, const char *end,
                                      CharInfo c, CharInfo *fail,
                                      size_t *mblen, size_t *clen) const {
@@ -82,6 +88,8 @@ class CharProperty {
   virtual ~CharProperty() { this->close(); }
 
  private:
+  bool init(const char *filename);
+
   scoped_ptr<Mmap<char> >   cmmap_;
   std::vector<const char *>  clist_;
   const CharInfo            *map_;
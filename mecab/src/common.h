@@ -66,6 +66,14 @@
 #endif
 #endif
 
+// AVX2 kernels are compiled with the target attribute and chosen at
+// run time, so that the binaries still run on older CPUs.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+  (defined(__clang__) || __GNUC__ > 4 || \
+   (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define MECAB_USE_AVX2 1
+#endif
+
 #define NBEST_MAX 512
 #define NODE_FREELIST_SIZE 512
 #define PATH_FREELIST_SIZE 2048
@@ -3,27 +3,244 @@
 //
 //  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <map>
 #include <sstream>
+#include <vector>
 #include "common.h"
 #include "connector.h"
+#include "dictionary.h"
 #include "mmap.h"
 #include "param.h"
 #include "utils.h"
 
 namespace MeCab {
 
-bool Connector::open(const Param &param) {
+namespace {
+const size_t kCacheLineSize = 64;
+
+// A compressed matrix starts with a 0x0 size, which no plain matrix.bin
+// carrying any cost has, followed by this header.
+const unsigned int kCompressedMatrixMagic = 0x584d434d;  // "MCMX"
+
+struct CompressedMatrixHeader {
+  unsigned short zero[2];
+  unsigned int   magic;
+  unsigned short lsize;
+  unsigned short rsize;
+  unsigned int   column_size;
+  unsigned int   row_size;
+  unsigned int   centroid_size;
+  unsigned int   delta_size;
+};
+
+// Compressed rows are built against the last kMaxCentroidCandidates
+// centroids only, to bound the compile time on large matrices.
+const size_t kMaxCentroidCandidates = 64;
+
+// Finds |base| and |delta| such that row[i] == base + centroid[i] +
+// delta[i]. Returns false if the differences do not fit in a signed char.
+bool make_delta(const short *row, const short *centroid, size_t size,
+                int *base, std::vector<signed char> *delta) {
+  int min_diff = row[0] - centroid[0];
+  int max_diff = min_diff;
+  for (size_t i = 1; i < size; ++i) {
+    const int diff = row[i] - centroid[i];
+    min_diff = std::min(min_diff, diff);
+    max_diff = std::max(max_diff, diff);
+    if (max_diff - min_diff > 255) {
+      return false;
+    }
+  }
+  *base = min_diff + 128;
+  delta->resize(size);
+  for (size_t i = 0; i < size; ++i) {
+    (*delta)[i] = static_cast<signed char>(row[i] - centroid[i] - *base);
+  }
+  return true;
+}
+
+// rounds |size| up to an even number.
+size_t padded_size(size_t size) {
+  return (size + 1) / 2 * 2;
+}
+
+// Writes |matrix| (|rsize| rows of |lsize| costs) in the compressed
+// format. Identical columns and identical rows are stored once, and
+// every distinct row is either kept as a centroid or stored as signed
+// char deltas against a previous centroid (or the zero row), so the
+// costs are reproduced exactly.
+void write_compressed(std::ofstream *ofs, const std::vector<short> &matrix,
+                      unsigned short lsize, unsigned short rsize) {
+  std::vector<unsigned short> col_id(lsize);
+  std::vector<size_t> cols;
+  {
+    std::map<std::vector<short>, unsigned short> dic;
+    std::vector<short> col(rsize);
+    for (size_t l = 0; l < lsize; ++l) {
+      for (size_t r = 0; r < rsize; ++r) {
+        col[r] = matrix[l + lsize * r];
+      }
+      std::map<std::vector<short>, unsigned short>::const_iterator it =
+          dic.find(col);
+      if (it != dic.end()) {
+        col_id[l] = it->second;
+      } else {
+        col_id[l] = cols.size();
+        dic.insert(std::make_pair(col, col_id[l]));
+        cols.push_back(l);
+      }
+    }
+  }
+
+  const size_t width = cols.size();
+  std::vector<unsigned short> row_id(rsize);
+  std::vector<CompressedRow> rows;
+  std::vector<short> centroid(width, 0);  // the zero row
+  std::vector<signed char> delta(width, 0);
+  std::vector<size_t> candidates(1, 0);
+  std::map<std::vector<short>, unsigned short> dic;
+  std::vector<short> row(width);
+  std::vector<signed char> tmp;
+
+  for (size_t r = 0; r < rsize; ++r) {
+    progress_bar("compressing matrix   ", r + 1, rsize);
+    for (size_t i = 0; i < width; ++i) {
+      row[i] = matrix[cols[i] + lsize * r];
+    }
+    std::map<std::vector<short>, unsigned short>::const_iterator it =
+        dic.find(row);
+    if (it != dic.end()) {
+      row_id[r] = it->second;
+      continue;
+    }
+
+    CompressedRow crow;
+    crow.base = 0;
+    crow.centroid = 0;
+    crow.delta = 0;
+    bool found = false;
+    for (size_t i = candidates.size(); i > 0; --i) {
+      int base = 0;
+      if (make_delta(&row[0], &centroid[candidates[i - 1]], width,
+                     &base, &tmp)) {
+        crow.base = base;
+        crow.centroid = candidates[i - 1];
+        crow.delta = delta.size();
+        delta.insert(delta.end(), tmp.begin(), tmp.end());
+        found = true;
+        break;
+      }
+    }
+
+    if (!found) {
+      crow.centroid = centroid.size();
+      centroid.insert(centroid.end(), row.begin(), row.end());
+      candidates.push_back(crow.centroid);
+      if (candidates.size() > kMaxCentroidCandidates) {
+        candidates.erase(candidates.begin() + 1);  // keep the zero row
+      }
+    }
+
+    row_id[r] = rows.size();
+    dic.insert(std::make_pair(row, row_id[r]));
+    rows.push_back(crow);
+  }
+
+  CompressedMatrixHeader header;
+  header.zero[0] = header.zero[1] = 0;
+  header.magic = kCompressedMatrixMagic;
+  header.lsize = lsize;
+  header.rsize = rsize;
+  header.column_size = width;
+  header.row_size = rows.size();
+  header.centroid_size = centroid.size();
+  header.delta_size = delta.size();
+  // keeps the rows 4-byte aligned
+  row_id.resize(padded_size(rsize), 0);
+  col_id.resize(padded_size(lsize), 0);
+  delta.resize(padded_size(delta.size()), 0);
+
+  ofs->write(reinterpret_cast<const char *>(&header), sizeof(header));
+  ofs->write(reinterpret_cast<const char *>(&row_id[0]),
+             sizeof(row_id[0]) * row_id.size());
+  ofs->write(reinterpret_cast<const char *>(&col_id[0]),
+             sizeof(col_id[0]) * col_id.size());
+  ofs->write(reinterpret_cast<const char *>(&rows[0]),
+             sizeof(rows[0]) * rows.size());
+  ofs->write(reinterpret_cast<const char *>(&centroid[0]),
+             sizeof(centroid[0]) * centroid.size());
+  ofs->write(reinterpret_cast<const char *>(&delta[0]), delta.size());
+
+  const size_t raw = sizeof(short) * (lsize * rsize + 2);
+  const size_t size = static_cast<size_t>(ofs->tellp());
+  std::cout << "compressed matrix: " << width << " distinct columns, "
+            << rows.size() << " distinct rows, "
+            << centroid.size() / width - 1 << " centroids, "
+            << size << " bytes (" << 100.0 * size / raw << "%)" << std::endl;
+}
+}
+
+bool Connector::open(const Param &param, const Bundle *bundle) {
   const std::string filename = create_filename
       (param.get<std::string>("dicdir"), MATRIX_FILE);
-  return open(filename.c_str());
+  if (bundle) {
+    const char *ptr = 0;
+    size_t size = 0;
+    CHECK_FALSE(bundle->find(MATRIX_FILE, &ptr, &size))
+        << "no such section: " << filename;
+    cmmap_->attach(filename.c_str(),
+                   reinterpret_cast<short *>(const_cast<char *>(ptr)), size);
+    if (!init(filename.c_str())) {
+      return false;
+    }
+  } else if (!open(filename.c_str(), dictionary_mode(param).c_str())) {
+    return false;
+  }
+  if (param.get<bool>("align-matrix") && !is_compressed()) {
+    align();
+  }
+  return true;
+}
+
+// Copies the matrix so that every row starts at a cache line boundary.
+// Within a connect() call the right node, i.e. the row, is fixed, and
+// the left nodes index the columns of that row, so a row is the unit
+// of locality. A cache line of padding is kept before the first row,
+// since row(lcAttr)[-1] must be readable.
+void Connector::align() {
+  const size_t line = kCacheLineSize / sizeof(short);
+  const size_t stride = (lsize_ + line - 1) / line * line;
+  const size_t size = sizeof(short) * stride * rsize_;
+
+  aligned_buf_.reset(new char[size + 2 * kCacheLineSize]);
+  char *begin = aligned_buf_.get() + kCacheLineSize;
+  begin += (kCacheLineSize -
+            reinterpret_cast<size_t>(begin) % kCacheLineSize) %
+      kCacheLineSize;
+  std::memset(aligned_buf_.get(), 0, size + 2 * kCacheLineSize);
+
+  short *matrix = reinterpret_cast<short *>(begin);
+  for (size_t lcAttr = 0; lcAttr < rsize_; ++lcAttr) {
+    std::copy(matrix_ + lsize_ * lcAttr, matrix_ + lsize_ * (lcAttr + 1),
+              matrix + stride * lcAttr);
+  }
+
+  cmmap_->close();
+  matrix_ = matrix;
+  stride_ = stride;
 }
 
 bool Connector::open(const char* filename,
                      const char *mode) {
   CHECK_FALSE(cmmap_->open(filename, mode))
       << "cannot open: " << filename;
+  return init(filename);
+}
 
+bool Connector::init(const char *filename) {
   matrix_ = cmmap_->begin();
 
   CHECK_FALSE(matrix_) << "matrix is NULL" ;
@@ -33,16 +250,78 @@ bool Connector::open(const char* filename,
   lsize_ = static_cast<unsigned short>((*cmmap_)[0]);
   rsize_ = static_cast<unsigned short>((*cmmap_)[1]);
 
+  if (lsize_ == 0 && rsize_ == 0 && cmmap_->size() > 2) {
+    return openCompressed(filename);
+  }
+
   CHECK_FALSE(static_cast<size_t>(lsize_ * rsize_ + 2)
                     == cmmap_->size())
       << "file size is invalid: " << filename;
 
   matrix_ = cmmap_->begin() + 2;
+  stride_ = lsize_;
+  return true;
+}
+
+bool Connector::openCompressed(const char *filename) {
+  const char *begin = reinterpret_cast<const char *>(cmmap_->begin());
+  const size_t file_size = sizeof(short) * cmmap_->size();
+  CHECK_FALSE(file_size >= sizeof(CompressedMatrixHeader))
+      << "file size is invalid: " << filename;
+
+  const CompressedMatrixHeader *header =
+      reinterpret_cast<const CompressedMatrixHeader *>(begin);
+  CHECK_FALSE(header->magic == kCompressedMatrixMagic)
+      << "invalid file format: " << filename;
+
+  lsize_ = header->lsize;
+  rsize_ = header->rsize;
+  stride_ = lsize_;
+
+  const char *ptr = begin + sizeof(*header);
+  row_id_ = reinterpret_cast<const unsigned short *>(ptr);
+  ptr += sizeof(unsigned short) * padded_size(rsize_);
+  col_id_ = reinterpret_cast<const unsigned short *>(ptr);
+  ptr += sizeof(unsigned short) * padded_size(lsize_);
+  rows_ = reinterpret_cast<const CompressedRow *>(ptr);
+  ptr += sizeof(CompressedRow) * header->row_size;
+  centroid_ = reinterpret_cast<const short *>(ptr);
+  ptr += sizeof(short) * header->centroid_size;
+  delta_ = reinterpret_cast<const signed char *>(ptr);
+  ptr += padded_size(header->delta_size);
+
+  CHECK_FALSE(static_cast<size_t>(ptr - begin) == file_size)
+      << "file size is invalid: " << filename;
+
+  for (size_t i = 0; i < rsize_; ++i) {
+    CHECK_FALSE(row_id_[i] < header->row_size)
+        << "broken matrix file: " << filename;
+  }
+  for (size_t i = 0; i < lsize_; ++i) {
+    CHECK_FALSE(col_id_[i] < header->column_size)
+        << "broken matrix file: " << filename;
+  }
+  for (size_t i = 0; i < header->row_size; ++i) {
+    CHECK_FALSE(rows_[i].centroid <= header->centroid_size &&
+                rows_[i].delta <= header->delta_size &&
+                header->centroid_size - rows_[i].centroid >=
+                header->column_size &&
+                header->delta_size - rows_[i].delta >= header->column_size)
+        << "broken matrix file: " << filename;
+  }
+
+  matrix_ = 0;
   return true;
 }
 
 void Connector::close() {
   cmmap_->close();
+  aligned_buf_.reset(0);
+  row_id_ = 0;
+  col_id_ = 0;
+  rows_ = 0;
+  centroid_ = 0;
+  delta_ = 0;
 }
 
 bool Connector::openText(const char *filename) {
@@ -58,10 +337,12 @@ bool Connector::openText(const char *filename) {
       << "format error: " << buf.get();
   lsize_ = std::atoi(column[0]);
   rsize_ = std::atoi(column[1]);
+  stride_ = lsize_;
   return true;
 }
 
-bool Connector::compile(const char *ifile, const char *ofile) {
+bool Connector::compile(const char *ifile, const char *ofile,
+                        bool compress) {
   std::ifstream ifs(WPATH(ifile));
   std::istringstream iss(MATRIX_DEF_DEFAULT);
   std::istream *is = &ifs;
@@ -102,6 +383,11 @@ bool Connector::compile(const char *ifile, const char *ofile) {
 
   std::ofstream ofs(WPATH(ofile), std::ios::binary|std::ios::out);
   CHECK_DIE(ofs) << "permission denied: " << ofile;
+  if (compress && lsize > 0 && rsize > 0) {
+    write_compressed(&ofs, matrix, lsize, rsize);
+    ofs.close();
+    return true;
+  }
   ofs.write(reinterpret_cast<const char*>(&lsize), sizeof(unsigned short));
   ofs.write(reinterpret_cast<const char*>(&rsize), sizeof(unsigned short));
   ofs.write(reinterpret_cast<const char*>(&matrix[0]),
@@ -13,18 +13,49 @@
 
 namespace MeCab {
 class Param;
+class Bundle;
+
+// A row of the compressed matrix. The cost is base + centroid[c] +
+// delta[c] for the column c = col_id[rcAttr], where centroid and delta
+// are offsets into the shared tables of short and signed char rows.
+struct CompressedRow {
+  int          base;
+  unsigned int centroid;
+  unsigned int delta;
+};
 
 class Connector {
  private:
   scoped_ptr<Mmap<short> >  cmmap_;
+  scoped_array<char>        aligned_buf_;
   short          *matrix_;
   unsigned short  lsize_;
   unsigned short  rsize_;
+  size_t          stride_;
+  // compressed matrix; row_id_ is NULL for the plain one.
+  const unsigned short *row_id_;
+  const unsigned short *col_id_;
+  const CompressedRow  *rows_;
+  const short          *centroid_;
+  const signed char    *delta_;
   whatlog         what_;
 
+  void align();
+  bool init(const char *filename);
+  bool openCompressed(const char *filename);
+
+  inline int compressed_cost(unsigned short rcAttr,
+                             unsigned short lcAttr) const {
+    const CompressedRow &row = rows_[row_id_[lcAttr]];
+    const size_t column = col_id_[rcAttr];
+    return row.base + centroid_[row.centroid + column] +
+        delta_[row.delta + column];
+  }
+
  public:
 
-  bool open(const Param &param);
+  // reads matrix.bin from |bundle| when given, from dicdir otherwise.
+  bool open(const Param &param, const Bundle *bundle = 0);
   void close();
   void clear() {}
 
@@ -33,21 +64,56 @@ class Connector {
   size_t left_size()  const { return static_cast<size_t>(lsize_); }
   size_t right_size() const { return static_cast<size_t>(rsize_); }
 
-  void set_left_size(size_t lsize)  { lsize_ = lsize; }
+  // memory holding the matrix; the aligned copy if align() was called.
+  const char *data() const {
+    return aligned_buf_.get() ?
+        reinterpret_cast<const char *>(matrix_) :
+        reinterpret_cast<const char *>(cmmap_->begin());
+  }
+  size_t data_size() const {
+    return aligned_buf_.get() ?
+        sizeof(short) * stride_ * rsize_ : cmmap_->file_size();
+  }
+
+  void set_left_size(size_t lsize)  { lsize_ = lsize; stride_ = lsize; }
   void set_right_size(size_t rsize) { rsize_ = rsize; }
 
   inline int transition_cost(unsigned short rcAttr,
                              unsigned short lcAttr) const {
-    return matrix_[rcAttr + lsize_ * lcAttr];
+    if (row_id_) {
+      return compressed_cost(rcAttr, lcAttr);
+    }
+    return matrix_[rcAttr + stride_ * lcAttr];
   }
 
   inline int cost(const Node *lNode, const Node *rNode) const {
-    return matrix_[lNode->rcAttr + lsize_ * rNode->lcAttr] + rNode->wcost;
+    return transition_cost(lNode->rcAttr, rNode->lcAttr) + rNode->wcost;
+  }
+
+  // true if the matrix was compiled with --compress-matrix. row() and
+  // matrix() die then, as there is no plain matrix to point to.
+  bool is_compressed() const { return row_id_ != 0; }
+
+  // costs from all the right context ids to |lcAttr|, indexed by rcAttr.
+  // row(lcAttr)[-1] is always readable.
+  inline const short *row(unsigned short lcAttr) const {
+    CHECK_DIE(!is_compressed()) << "the matrix is compressed";
+    return matrix_ + stride_ * lcAttr;
   }
 
+  // distance between two rows. It is left_size() unless the rows are
+  // aligned to cache lines.
+  size_t stride() const { return stride_; }
+
   // access to raw matrix
-  short *mutable_matrix() { return &matrix_[0]; }
-  const short *matrix() const { return &matrix_[0]; }
+  short *mutable_matrix() {
+    CHECK_DIE(!is_compressed()) << "the matrix is compressed";
+    return &matrix_[0];
+  }
+  const short *matrix() const {
+    CHECK_DIE(!is_compressed()) << "the matrix is compressed";
+    return &matrix_[0];
+  }
 
   bool openText(const char *filename);
   bool open(const char *filename, const char *mode = "r");
@@ -56,10 +122,11 @@ class Connector {
     return (lid >= 0 && lid < rsize_ && rid >= 0 && rid < lsize_);
   }
 
-  static bool compile(const char *, const char *);
+  static bool compile(const char *, const char *, bool compress = false);
 
   explicit Connector():
-      cmmap_(new Mmap<short>), matrix_(0), lsize_(0), rsize_(0) {}
+      cmmap_(new Mmap<short>), matrix_(0), lsize_(0), rsize_(0),
+      stride_(0), row_id_(0), col_id_(0), rows_(0), centroid_(0), delta_(0) {}
 
   virtual ~Connector() { this->close(); }
 };
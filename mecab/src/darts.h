@@ -63,6 +63,9 @@ class DoubleArrayImpl {
   };
 
   unit_t        *array_;
+  // the compact layout, see compact().
+  const unsigned int *units_;
+  const array_type_  *values_;
   unsigned char *used_;
   size_t        size_;
   size_t        alloc_size_;
@@ -216,7 +219,7 @@ class DoubleArrayImpl {
     size_t     length;
   };
 
-  explicit DoubleArrayImpl(): array_(0), used_(0),
+  explicit DoubleArrayImpl(): array_(0), units_(0), values_(0), used_(0),
                               size_(0), alloc_size_(0),
                               no_delete_(0), error_(0) {}
   ~DoubleArrayImpl() { clear(); }
@@ -237,6 +240,61 @@ class DoubleArrayImpl {
     size_ = size;
   }
 
+  // The compact layout packs a unit into 32 bits: the label of the
+  // transition into the unit in the low kLabelBits bits and the base
+  // above them. The label is the code of the byte plus one, 0 for the
+  // end of a key, or kEmptyLabel. Since darts gives every node its own
+  // base, a matching label proves that the unit is a child of the
+  // node, as check does. An end-of-key unit holds an index into the
+  // values that follow the units.
+  //
+  // The block is the number of units, the units and the values.
+  enum { kLabelBits = 9, kEmptyLabel = (1 << kLabelBits) - 1 };
+
+  // Converts the built array into the compact layout. Returns false if
+  // the bases or the values do not fit into 32 - kLabelBits bits.
+  bool compact(std::vector<unsigned int> *block) const {
+    const size_t kMaxBase = 1 << (32 - kLabelBits);
+    if (size_ >= kMaxBase) return false;
+    std::vector<unsigned int> units(size_);
+    std::vector<unsigned int> values;
+    for (size_t p = 0; p < size_; ++p) {
+      const array_type_ base = array_[p].base;
+      const array_u_type_ check = array_[p].check;
+      if (p == 0) {
+        units[p] = (static_cast<unsigned int>(base) << kLabelBits) |
+            kEmptyLabel;
+      } else if (check == 0) {
+        units[p] = kEmptyLabel;
+      } else if (p == check) {
+        if (base >= 0 || values.size() >= kMaxBase) return false;
+        units[p] = static_cast<unsigned int>(values.size()) << kLabelBits;
+        values.push_back(static_cast<unsigned int>(-base - 1));
+      } else {
+        if (base < 0) return false;
+        units[p] = (static_cast<unsigned int>(base) << kLabelBits) |
+            static_cast<unsigned int>(p - check);
+      }
+    }
+    block->clear();
+    block->push_back(static_cast<unsigned int>(size_));
+    block->insert(block->end(), units.begin(), units.end());
+    block->insert(block->end(), values.begin(), values.end());
+    return true;
+  }
+
+  // Uses the compact block at |ptr|, see compact().
+  void set_compact_array(const void *ptr) {
+    clear();
+    const unsigned int *block = reinterpret_cast<const unsigned int *>(ptr);
+    size_ = block[0];
+    units_ = block + 1;
+    values_ = reinterpret_cast<const array_type_ *>(units_ + size_);
+    no_delete_ = true;
+  }
+
+  bool is_compact() const { return units_ != 0; }
+
   const void *array() const {
     return const_cast<const void *>(reinterpret_cast<void *>(array_));
   }
@@ -246,6 +304,8 @@ class DoubleArrayImpl {
       delete [] array_;
     delete [] used_;
     array_ = 0;
+    units_ = 0;
+    values_ = 0;
     used_ = 0;
     alloc_size_ = 0;
     size_ = 0;
@@ -404,6 +464,20 @@ class DoubleArrayImpl {
     T result;
     set_result(result, -1, 0);
 
+    if (units_) {
+      unsigned int b = units_[node_pos] >> kLabelBits;
+      for (size_t i = 0; i < len; ++i) {
+        const unsigned int code = (node_u_type_)(key[i]) + 1;
+        const unsigned int u = units_[b + code];
+        if ((u & kEmptyLabel) != code) return result;
+        b = u >> kLabelBits;
+      }
+      const unsigned int u = units_[b];
+      if ((u & kEmptyLabel) == 0)
+        set_result(result, values_[u >> kLabelBits], len);
+      return result;
+    }
+
     register array_type_  b = array_[node_pos].base;
     register array_u_type_ p;
 
@@ -431,6 +505,11 @@ class DoubleArrayImpl {
                             size_t node_pos = 0) const {
     if (!len) len = length_func_()(key);
 
+    if (units_) {
+      return compactCommonPrefixSearch(key, result, result_len, len,
+                                       node_pos);
+    }
+
     register array_type_  b   = array_[node_pos].base;
     register size_t     num = 0;
     register array_type_  n;
@@ -463,6 +542,139 @@ class DoubleArrayImpl {
     return num;
   }
 
+  // Returns the number of bytes of |key| commonPrefixSearch() reads,
+  // i.e. up to and including the byte on which the walk fails.
+  size_t depth(const key_type *key, size_t len) const {
+    if (units_) {
+      unsigned int b = units_[0] >> kLabelBits;
+      for (size_t i = 0; i < len; ++i) {
+        const unsigned int code = (node_u_type_)(key[i]) + 1;
+        const unsigned int u = units_[b + code];
+        if ((u & kEmptyLabel) != code) return i + 1;
+        b = u >> kLabelBits;
+      }
+      return len;
+    }
+    array_type_ b = array_[0].base;
+    for (size_t i = 0; i < len; ++i) {
+      const array_u_type_ p = b + (node_u_type_)(key[i]) + 1;
+      if (static_cast<array_u_type_>(b) != array_[p].check) return i + 1;
+      b = array_[p].base;
+    }
+    return len;
+  }
+
+  // commonPrefixSearch() on the compact layout. The unit of the next
+  // transition is prefetched before the end of the key is checked, so
+  // that the two loads of a step overlap.
+  template <class T>
+  size_t compactCommonPrefixSearch(const key_type *key,
+                                   T* result,
+                                   size_t result_len,
+                                   size_t len,
+                                   size_t node_pos) const {
+    unsigned int b = units_[node_pos] >> kLabelBits;
+    size_t num = 0;
+
+    for (size_t i = 0; i < len; ++i) {
+      const unsigned int code = (node_u_type_)(key[i]) + 1;
+      const unsigned int *next = units_ + b + code;
+#if defined(__GNUC__)
+      __builtin_prefetch(next);
+#endif
+      const unsigned int u = units_[b];
+      if ((u & kEmptyLabel) == 0) {
+        if (num < result_len)
+          set_result(result[num], values_[u >> kLabelBits], i);
+        ++num;
+      }
+      if ((*next & kEmptyLabel) != code) return num;
+      b = *next >> kLabelBits;
+    }
+
+    const unsigned int u = units_[b];
+    if ((u & kEmptyLabel) == 0) {
+      if (num < result_len)
+        set_result(result[num], values_[u >> kLabelBits], len);
+      ++num;
+    }
+
+    return num;
+  }
+
+  // Runs commonPrefixSearch() of the |size| tries |da| over |key| at
+  // once. Each byte of the key is read once and all the live tries
+  // take their step on it, and the walk ends as soon as no trie has a
+  // node left. The matches of da[k] are stored from
+  // result[k * result_len] and counted in num[k].
+  template <class T>
+  static void commonPrefixSearch(const DoubleArrayImpl *const *da,
+                                 size_t size,
+                                 const key_type *key,
+                                 T *result,
+                                 size_t result_len,
+                                 size_t *num,
+                                 size_t len) {
+    const size_t kGroupSize = 16;
+    array_type_ b[kGroupSize];
+    size_t live[kGroupSize];
+
+    for (size_t g = 0; g < size; g += kGroupSize) {
+      const size_t group_size =
+          size - g < kGroupSize ? size - g : kGroupSize;
+      size_t alive = 0;
+      for (size_t k = 0; k < group_size; ++k) {
+        const DoubleArrayImpl *d = da[g + k];
+        b[k] = d->units_ ?
+            static_cast<array_type_>(d->units_[0] >> kLabelBits) :
+            d->array_[0].base;
+        num[g + k] = 0;
+        live[alive++] = k;
+      }
+
+      for (size_t i = 0; i <= len && alive; ++i) {
+        const unsigned int code = i < len ? (node_u_type_)(key[i]) + 1 : 0;
+        size_t next = 0;
+        for (size_t j = 0; j < alive; ++j) {
+          const size_t k = live[j];
+          const DoubleArrayImpl *d = da[g + k];
+          const array_type_ base = b[k];
+          T *r = result + (g + k) * result_len;
+          if (d->units_) {
+            const unsigned int u = d->units_[base];
+            if ((u & kEmptyLabel) == 0) {
+              if (num[g + k] < result_len)
+                d->set_result(r[num[g + k]], d->values_[u >> kLabelBits], i);
+              ++num[g + k];
+            }
+            if (i == len) continue;
+            const unsigned int v = d->units_[base + code];
+            if ((v & kEmptyLabel) == code) {
+              b[k] = static_cast<array_type_>(v >> kLabelBits);
+              live[next++] = k;
+            }
+            continue;
+          }
+          const unit_t *array = d->array_;
+          const array_type_ n = array[base].base;
+          if (static_cast<array_u_type_>(base) == array[base].check &&
+              n < 0) {
+            if (num[g + k] < result_len)
+              d->set_result(r[num[g + k]], -n-1, i);
+            ++num[g + k];
+          }
+          if (i == len) continue;
+          const array_u_type_ p = base + code;
+          if (static_cast<array_u_type_>(base) == array[p].check) {
+            b[k] = array[p].base;
+            live[next++] = k;
+          }
+        }
+        alive = next;
+      }
+    }
+  }
+
   value_type traverse(const key_type *key,
                       size_t &node_pos,
                       size_t &key_pos,
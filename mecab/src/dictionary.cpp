@@ -5,6 +5,8 @@
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
 #include <fstream>
 #include <climits>
+#include <cstring>
+#include <iterator>
 #include "connector.h"
 #include "context_id.h"
 #include "char_property.h"
@@ -24,6 +26,35 @@ namespace {
 
 const unsigned int DictionaryMagicID = 0xef718f77u;
 
+const unsigned int kBundleMagic = 0x444e424d;  // "MBND"
+const unsigned int kBundleVersion = 1;
+const size_t kBundleAlignment = 4096;
+
+struct BundleHeader {
+  unsigned int magic;
+  unsigned int version;
+  unsigned int size;      // number of sections
+  unsigned int checksum;  // of the section table
+};
+
+struct BundleSection {
+  char         name[32];
+  unsigned int offset;
+  unsigned int size;
+  unsigned int checksum;
+  unsigned int reserved;
+};
+
+// 32-bit FNV-1a.
+unsigned int fnv_checksum(const char *ptr, size_t size) {
+  unsigned int h = 2166136261u;
+  for (size_t i = 0; i < size; ++i) {
+    h ^= static_cast<unsigned char>(ptr[i]);
+    h *= 16777619u;
+  }
+  return h;
+}
+
 int toInt(const char *str) {
   if (!str || std::strlen(str) == 0) {
     return INT_MAX;
@@ -64,6 +95,42 @@ int progress_bar_darts(size_t current, size_t total) {
   return progress_bar("emitting double-array", current, total);
 }
 
+// Appends the column table of |feature| to |fbuf|, which is laid out
+// right before the feature string as
+//   [end of column 0] ... [end of column n-1] [n]
+// in 2-byte aligned unsigned shorts. The columns are the ones split by
+// tokenizeCSV(). n is 0 if some column is quoted or prefixed by spaces,
+// since it cannot be referred to without copying. It is also 0 if the
+// feature does not fit in BUF_SIZE.
+void append_feature_columns(const std::string &feature, std::string *fbuf) {
+  std::vector<unsigned short> ends;
+  if (feature.size() < BUF_SIZE &&
+      feature.find('"') == std::string::npos) {
+    scoped_fixed_array<char, BUF_SIZE> buf;
+    scoped_fixed_array<char *, 64> col;
+    std::strncpy(buf.get(), feature.c_str(), buf.size() - 1);
+    buf[buf.size() - 1] = '\0';
+    const size_t n = tokenizeCSV(buf.get(), col.get(), col.size());
+    size_t begin = 0;
+    for (size_t i = 0; i < n; ++i) {
+      if (col[i] != buf.get() + begin) {
+        ends.clear();
+        break;
+      }
+      const size_t end = begin + std::strlen(col[i]);
+      ends.push_back(static_cast<unsigned short>(end));
+      begin = end + 1;
+    }
+  }
+
+  if (fbuf->size() % 2 != 0) {
+    fbuf->append("\0", 1);
+  }
+  ends.push_back(static_cast<unsigned short>(ends.size()));
+  fbuf->append(reinterpret_cast<const char *>(&ends[0]),
+               sizeof(ends[0]) * ends.size());
+}
+
 template <typename T1, typename T2>
 struct pair_1st_cmp: public std::binary_function<bool, T1, T2> {
   bool operator()(const std::pair<T1, T2> &x1,
@@ -76,9 +143,26 @@ struct pair_1st_cmp: public std::binary_function<bool, T1, T2> {
 bool Dictionary::open(const char *file, const char *mode) {
   close();
   filename_.assign(file);
+  section_.clear();
   CHECK_FALSE(dmmap_->open(file, mode))
       << "no such file or directory: " << file;
+  return init();
+}
 
+bool Dictionary::open(const Bundle &bundle, const char *name) {
+  close();
+  filename_.assign(bundle.filename());
+  section_.assign(name);
+  const char *ptr = 0;
+  size_t size = 0;
+  CHECK_FALSE(bundle.find(name, &ptr, &size))
+      << "no such section: " << name << " in " << filename_;
+  dmmap_->attach(filename_.c_str(), const_cast<char *>(ptr), size);
+  return init();
+}
+
+bool Dictionary::init() {
+  const char *file = filename_.c_str();
   CHECK_FALSE(dmmap_->size() >= 100)
       << "dictionary file is broken: " << file;
 
@@ -88,15 +172,17 @@ bool Dictionary::open(const char *file, const char *mode) {
   unsigned int tsize;
   unsigned int fsize;
   unsigned int magic;
-  unsigned int dummy;
 
   read_static<unsigned int>(&ptr, magic);
   CHECK_FALSE((magic ^ DictionaryMagicID) == dmmap_->size())
       << "dictionary file is broken: " << file;
 
-  read_static<unsigned int>(&ptr, version_);
-  CHECK_FALSE(version_ == DIC_VERSION)
-      << "incompatible version: " << version_;
+  unsigned int version = 0;
+  read_static<unsigned int>(&ptr, version);
+  CHECK_FALSE(version == DIC_VERSION || version == DIC_COMPACT_TRIE_VERSION)
+      << "incompatible version: " << version;
+  // the layout of the double array is told by the flags below.
+  version_ = DIC_VERSION;
 
   read_static<unsigned int>(&ptr, type_);
   read_static<unsigned int>(&ptr, lexsize_);
@@ -105,11 +191,20 @@ bool Dictionary::open(const char *file, const char *mode) {
   read_static<unsigned int>(&ptr, dsize);
   read_static<unsigned int>(&ptr, tsize);
   read_static<unsigned int>(&ptr, fsize);
-  read_static<unsigned int>(&ptr, dummy);
+  read_static<unsigned int>(&ptr, flags_);
+  CHECK_FALSE((flags_ & ~DICTIONARY_KNOWN_FLAGS) == 0)
+      << "unsupported dictionary flags: " << flags_;
+  CHECK_FALSE(((flags_ & DICTIONARY_COMPACT_TRIE) != 0) ==
+              (version == DIC_COMPACT_TRIE_VERSION))
+      << "dictionary file is broken: " << file;
 
   charset_ = ptr;
   ptr += 32;
-  da_.set_array(reinterpret_cast<void *>(const_cast<char*>(ptr)));
+  if (flags_ & DICTIONARY_COMPACT_TRIE) {
+    da_.set_compact_array(ptr);
+  } else {
+    da_.set_array(reinterpret_cast<void *>(const_cast<char*>(ptr)));
+  }
 
   ptr += dsize;
 
@@ -118,6 +213,7 @@ bool Dictionary::open(const char *file, const char *mode) {
 
   feature_ = ptr;
   ptr += fsize;
+  feature_end_ = ptr;
 
   CHECK_FALSE(ptr == dmmap_->end())
       << "dictionary file is broken: " << file;
@@ -129,6 +225,172 @@ void Dictionary::close() {
   dmmap_->close();
 }
 
+bool Bundle::open(const char *filename, const char *mode) {
+  close();
+  filename_.assign(filename);
+  CHECK_FALSE(mmap_->open(filename, mode))
+      << "no such file or directory: " << filename;
+
+  const char *begin = mmap_->begin();
+  const size_t file_size = mmap_->file_size();
+  CHECK_FALSE(file_size >= sizeof(BundleHeader))
+      << "bundle file is broken: " << filename;
+  const BundleHeader *header = reinterpret_cast<const BundleHeader *>(begin);
+  CHECK_FALSE(header->magic == kBundleMagic)
+      << "not a dictionary bundle: " << filename;
+  CHECK_FALSE(header->version == kBundleVersion)
+      << "incompatible version: " << header->version;
+
+  const size_t table_size = sizeof(BundleSection) * header->size;
+  CHECK_FALSE(file_size >= sizeof(BundleHeader) + table_size)
+      << "bundle file is broken: " << filename;
+  const BundleSection *section = reinterpret_cast<const BundleSection *>(
+      begin + sizeof(BundleHeader));
+  CHECK_FALSE(fnv_checksum(reinterpret_cast<const char *>(section),
+                           table_size) == header->checksum)
+      << "bundle file is broken: " << filename;
+  for (size_t i = 0; i < header->size; ++i) {
+    CHECK_FALSE(section[i].offset <= file_size &&
+                section[i].size <= file_size - section[i].offset)
+        << "bundle file is broken: " << filename;
+  }
+
+  return true;
+}
+
+void Bundle::close() {
+  mmap_->close();
+}
+
+bool Bundle::find(const char *name, const char **ptr, size_t *size) const {
+  const char *begin = mmap_->begin();
+  if (!begin) {
+    return false;
+  }
+  const BundleHeader *header = reinterpret_cast<const BundleHeader *>(begin);
+  const BundleSection *section = reinterpret_cast<const BundleSection *>(
+      begin + sizeof(BundleHeader));
+  for (size_t i = 0; i < header->size; ++i) {
+    if (std::strncmp(section[i].name, name, sizeof(section[i].name)) == 0) {
+      *ptr = begin + section[i].offset;
+      *size = section[i].size;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *Bundle::verify() const {
+  const char *begin = mmap_->begin();
+  if (!begin) {
+    return 0;
+  }
+  const BundleHeader *header = reinterpret_cast<const BundleHeader *>(begin);
+  const BundleSection *section = reinterpret_cast<const BundleSection *>(
+      begin + sizeof(BundleHeader));
+  for (size_t i = 0; i < header->size; ++i) {
+    if (fnv_checksum(begin + section[i].offset, section[i].size) !=
+        section[i].checksum) {
+      return section[i].name;
+    }
+  }
+  return 0;
+}
+
+bool Bundle::read(const char *filename, const char *name,
+                  std::string *result) {
+  std::ifstream ifs(WPATH(filename), std::ios::binary|std::ios::in);
+  CHECK_FALSE(ifs) << "no such file or directory: " << filename;
+
+  BundleHeader header;
+  ifs.read(reinterpret_cast<char *>(&header), sizeof(header));
+  CHECK_FALSE(ifs && header.magic == kBundleMagic)
+      << "not a dictionary bundle: " << filename;
+  CHECK_FALSE(header.version == kBundleVersion)
+      << "incompatible version: " << header.version;
+
+  std::vector<BundleSection> section(header.size);
+  if (header.size) {
+    ifs.read(reinterpret_cast<char *>(&section[0]),
+             sizeof(BundleSection) * section.size());
+    CHECK_FALSE(ifs &&
+                fnv_checksum(reinterpret_cast<const char *>(&section[0]),
+                             sizeof(BundleSection) * section.size()) ==
+                header.checksum)
+        << "bundle file is broken: " << filename;
+  }
+
+  for (size_t i = 0; i < section.size(); ++i) {
+    if (std::strncmp(section[i].name, name, sizeof(section[i].name)) != 0) {
+      continue;
+    }
+    result->resize(section[i].size);
+    ifs.seekg(section[i].offset);
+    if (section[i].size) {
+      ifs.read(&(*result)[0], section[i].size);
+    }
+    CHECK_FALSE(ifs && fnv_checksum(result->data(), result->size()) ==
+                section[i].checksum)
+        << "bundle file is broken: " << filename;
+    return true;
+  }
+
+  WHAT << "no " << name << " in the bundle: " << filename;
+  return false;
+}
+
+bool Bundle::compile(const std::vector<std::string> &names,
+                     const std::vector<std::string> &paths,
+                     const char *output) {
+  CHECK_DIE(names.size() == paths.size());
+
+  std::vector<std::string> data(paths.size());
+  std::vector<BundleSection> section(paths.size());
+  size_t offset = sizeof(BundleHeader) + sizeof(BundleSection) * paths.size();
+  for (size_t i = 0; i < paths.size(); ++i) {
+    CHECK_DIE(names[i].size() < sizeof(section[i].name))
+        << "too long section name: " << names[i];
+    std::ifstream ifs(WPATH(paths[i].c_str()), std::ios::binary|std::ios::in);
+    CHECK_DIE(ifs) << "no such file or directory: " << paths[i];
+    data[i].assign(std::istreambuf_iterator<char>(ifs),
+                   std::istreambuf_iterator<char>());
+
+    offset = (offset + kBundleAlignment - 1) /
+        kBundleAlignment * kBundleAlignment;
+    std::memset(&section[i], 0, sizeof(section[i]));
+    std::strncpy(section[i].name, names[i].c_str(), sizeof(section[i].name));
+    section[i].offset = static_cast<unsigned int>(offset);
+    section[i].size = static_cast<unsigned int>(data[i].size());
+    section[i].checksum = fnv_checksum(data[i].data(), data[i].size());
+    offset += data[i].size();
+    CHECK_DIE(offset <= 0xffffffffu) << "bundle is too large: " << output;
+  }
+
+  BundleHeader header;
+  header.magic = kBundleMagic;
+  header.version = kBundleVersion;
+  header.size = static_cast<unsigned int>(section.size());
+  header.checksum = section.empty() ? fnv_checksum(0, 0) :
+      fnv_checksum(reinterpret_cast<const char *>(&section[0]),
+                   sizeof(BundleSection) * section.size());
+
+  std::ofstream ofs(WPATH(output), std::ios::binary|std::ios::out);
+  CHECK_DIE(ofs) << "permission denied: " << output;
+  ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  if (!section.empty()) {
+    ofs.write(reinterpret_cast<const char *>(&section[0]),
+              sizeof(BundleSection) * section.size());
+  }
+  for (size_t i = 0; i < section.size(); ++i) {
+    const size_t pad = section[i].offset - static_cast<size_t>(ofs.tellp());
+    ofs << std::string(pad, '\0');
+    ofs.write(data[i].data(), data[i].size());
+  }
+  CHECK_DIE(ofs) << "cannot write: " << output;
+
+  return true;
+}
+
 #define DCONF(file) create_filename(dicdir, std::string(file));
 
 bool Dictionary::assignUserDictionaryCosts(
@@ -252,6 +514,9 @@ bool Dictionary::compile(const Param &param,
   const std::string from = param.get<std::string>("dictionary-charset");
   const std::string to = param.get<std::string>("charset");
   const bool wakati = param.get<bool>("wakati");
+  const bool feature_columns =
+      !wakati && param.get<bool>("feature-columns");
+  const bool compact_trie = param.get<bool>("compact-trie");
   const int type = param.get<int>("type");
   const std::string node_format = param.get<std::string>("node-format");
   const int factor = param.get<int>("cost-factor");
@@ -408,6 +673,11 @@ bool Dictionary::compile(const Param &param,
         key = feature + '\0';
       }
 
+      if (feature_columns) {
+        append_feature_columns(feature, &fbuf);
+        offset = fbuf.size();
+      }
+
       Token* token  = new Token;
       token->lcAttr = lid;
       token->rcAttr = rid;
@@ -483,14 +753,34 @@ bool Dictionary::compile(const Param &param,
     tbuf.append(reinterpret_cast<const char*>(&dummy), sizeof(Token));
   }
 
-  unsigned int dummy = 0;
+  unsigned int flags = 0;
+  if (feature_columns) {
+    flags |= DICTIONARY_FEATURE_COLUMNS;
+  }
+
+  std::vector<unsigned int> compact;
+  if (compact_trie) {
+    if (da.compact(&compact)) {
+      flags |= DICTIONARY_COMPACT_TRIE;
+      // keeps the tokens 8byte aligned
+      if (compact.size() % 2 != 0) {
+        compact.push_back(0);
+      }
+    } else {
+      std::cerr << "the double-array is too large for --compact-trie. "
+                << "the default layout is used." << std::endl;
+    }
+  }
+
   unsigned int lsize = matrix.left_size();
   unsigned int rsize = matrix.right_size();
-  unsigned int dsize = da.unit_size() * da.size();
+  unsigned int dsize = (flags & DICTIONARY_COMPACT_TRIE) ?
+      sizeof(unsigned int) * compact.size() : da.unit_size() * da.size();
   unsigned int tsize = tbuf.size();
   unsigned int fsize = fbuf.size();
 
-  unsigned int version = DIC_VERSION;
+  unsigned int version = (flags & DICTIONARY_COMPACT_TRIE) ?
+      DIC_COMPACT_TRIE_VERSION : DIC_VERSION;
   char charset[32];
   std::fill(charset, charset + sizeof(charset), '\0');
   std::strncpy(charset, to.c_str(), 31);
@@ -511,13 +801,16 @@ bool Dictionary::compile(const Param &param,
   bofs.write(reinterpret_cast<const char *>(&dsize),   sizeof(unsigned int));
   bofs.write(reinterpret_cast<const char *>(&tsize),   sizeof(unsigned int));
   bofs.write(reinterpret_cast<const char *>(&fsize),   sizeof(unsigned int));
-  bofs.write(reinterpret_cast<const char *>(&dummy),   sizeof(unsigned int));
+  bofs.write(reinterpret_cast<const char *>(&flags),   sizeof(unsigned int));
 
   // 32 * 8 = 64 * 4
   bofs.write(reinterpret_cast<const char *>(charset),  sizeof(charset));
 
-  bofs.write(reinterpret_cast<const char*>(da.array()),
-             da.unit_size() * da.size());
+  if (flags & DICTIONARY_COMPACT_TRIE) {
+    bofs.write(reinterpret_cast<const char*>(&compact[0]), dsize);
+  } else {
+    bofs.write(reinterpret_cast<const char*>(da.array()), dsize);
+  }
   bofs.write(const_cast<const char *>(tbuf.data()), tbuf.size());
   bofs.write(const_cast<const char *>(fbuf.data()), fbuf.size());
 
@@ -14,6 +14,21 @@
 namespace MeCab {
 
 class Param;
+class Bundle;
+
+// flags in the dictionary header
+enum {
+  // each feature string is preceded by its column table
+  DICTIONARY_FEATURE_COLUMNS = 1,
+  // the double array is in the compact 32-bit layout
+  DICTIONARY_COMPACT_TRIE = 2,
+  DICTIONARY_KNOWN_FLAGS = DICTIONARY_FEATURE_COLUMNS | DICTIONARY_COMPACT_TRIE
+};
+
+// the version written to a dictionary with DICTIONARY_COMPACT_TRIE, so
+// that the readers which know DIC_VERSION only reject it rather than
+// read the compact double array as the default one.
+#define DIC_COMPACT_TRIE_VERSION (0x10000 + DIC_VERSION)
 
 struct Token {
   unsigned short lcAttr;
@@ -29,6 +44,8 @@ class Dictionary {
   typedef Darts::DoubleArray::result_pair_type result_type;
 
   bool open(const char *filename, const char *mode = "r");
+  // opens the section |name| of |bundle|.
+  bool open(const Bundle &bundle, const char *name);
   void close();
 
   size_t commonPrefixSearch(const char* key, size_t len,
@@ -37,6 +54,15 @@ class Dictionary {
     return da_.commonPrefixSearch(key, result, rlen, len);
   }
 
+  // the trie, for Darts::DoubleArray::commonPrefixSearch() over
+  // several dictionaries at once.
+  const Darts::DoubleArray *double_array() const { return &da_; }
+
+  // the number of bytes of |key| commonPrefixSearch() reads.
+  size_t prefixDepth(const char *key, size_t len) const {
+    return da_.depth(key, len);
+  }
+
   result_type exactMatchSearch(const char* key) const {
     result_type n;
     da_.exactMatchSearch(key, n);
@@ -52,6 +78,9 @@ class Dictionary {
   }
 
   const char *filename() const { return filename_.c_str(); }
+  // the section of the bundle filename() which holds the dictionary,
+  // or "" if the dictionary is a file of its own.
+  const char *section() const { return section_.c_str(); }
   const char *charset() const { return const_cast<const char*>(charset_); }
   unsigned short version() const { return version_; }
   size_t  size() const { return static_cast<size_t>(lexsize_); }
@@ -59,12 +88,52 @@ class Dictionary {
   size_t lsize() const { return static_cast<size_t>(lsize_); }
   size_t rsize() const { return static_cast<size_t>(rsize_); }
 
+  // memory holding the dictionary file.
+  const char *data() const { return dmmap_->begin(); }
+  size_t data_size() const { return dmmap_->file_size(); }
+
   const Token *token(const result_type &n) const {
     return token_ +(n.value >> 8);
   }
   size_t token_size(const result_type &n) const { return 0xff & n.value; }
   const char  *feature(const Token &t) const { return feature_ + t.feature; }
 
+  // true if |feature| points into the feature strings of this dictionary.
+  bool has_feature(const char *feature) const {
+    return feature >= feature_ && feature < feature_end_;
+  }
+
+  // Returns the number of CSV columns of |feature|, which must be a
+  // feature string of this dictionary, and stores their end offsets to
+  // |ends|. The i-th column spans [i ? ends[i-1] + 1 : 0, ends[i]).
+  // Returns 0 if the dictionary has no column tables, or |feature|
+  // needs the full CSV parsing (quoted or space-prefixed columns).
+  size_t feature_columns(const char *feature,
+                         const unsigned short **ends) const {
+    if (!(flags_ & DICTIONARY_FEATURE_COLUMNS)) {
+      return 0;
+    }
+    const unsigned short *size =
+        reinterpret_cast<const unsigned short *>(feature) - 1;
+    *ends = size - *size;
+    return *size;
+  }
+
+  // Returns the |n|-th CSV column of the feature of |t| without copying,
+  // or NULL if it is not available from the column table.
+  // The column is not NUL-terminated; its length is stored to |length|.
+  const char *feature_column(const Token &t, size_t n,
+                             size_t *length) const {
+    const char *f = feature(t);
+    const unsigned short *ends = 0;
+    if (n >= feature_columns(f, &ends)) {
+      return 0;
+    }
+    const size_t begin = n ? ends[n - 1] + 1 : 0;
+    *length = ends[n] - begin;
+    return f + begin;
+  }
+
   static bool compile(const Param &param,
                       const std::vector<std::string> &dics,
                       const char *output);  // outputs
@@ -78,22 +147,74 @@ class Dictionary {
   const char *what() { return what_.str(); }
 
   explicit Dictionary(): dmmap_(new Mmap<char>), token_(0),
-                         feature_(0), charset_(0) {}
+                         feature_(0), feature_end_(0), charset_(0),
+                         flags_(0) {}
   virtual ~Dictionary() { this->close(); }
 
  private:
+  bool init();
+
   scoped_ptr<Mmap<char> > dmmap_;
   const Token        *token_;
   const char         *feature_;
+  const char         *feature_end_;
   const char         *charset_;
+  unsigned int        flags_;
   unsigned int        version_;
   unsigned int        type_;
   unsigned int        lexsize_;
   unsigned int        lsize_;
   unsigned int        rsize_;
   std::string         filename_;
+  std::string         section_;
   whatlog             what_;
   Darts::DoubleArray  da_;
 };
+
+// A dictionary bundle packs the files which the tagger reads from a
+// system dictionary directory (dicrc, sys.dic, unk.dic, char.bin and
+// matrix.bin) into one file, so that a model is opened with a single
+// mmap. mecab-dict-index --bundle=FILE writes it, and giving FILE as
+// the dicdir makes the tagger read it.
+//
+// The file starts with a header and a table of sections. Each section
+// starts at a multiple of kBundleAlignment bytes, so the mapped files
+// keep their page alignment. The table and every section carry an
+// FNV-1a checksum. The table is checked when the bundle is opened;
+// the sections are checked by verify() only, since that reads every
+// page.
+class Bundle {
+ public:
+  bool open(const char *filename, const char *mode = "r");
+  void close();
+
+  // Finds the section |name|, e.g. SYS_DIC_FILE.
+  bool find(const char *name, const char **ptr, size_t *size) const;
+
+  // Returns the name of the first broken section, or NULL.
+  const char *verify() const;
+
+  const char *filename() const { return filename_.c_str(); }
+  const char *what() { return what_.str(); }
+
+  // Reads the section |name| of the bundle |filename| without mapping
+  // the file. Used for dicrc, which is needed before the model opens.
+  // Returns false if |filename| is not a bundle, is broken, or has no
+  // section |name|; what() tells which.
+  bool read(const char *filename, const char *name, std::string *section);
+
+  // Writes the files |paths| into |output| as the sections |names|.
+  static bool compile(const std::vector<std::string> &names,
+                      const std::vector<std::string> &paths,
+                      const char *output);
+
+  explicit Bundle(): mmap_(new Mmap<char>) {}
+  virtual ~Bundle() { this->close(); }
+
+ private:
+  scoped_ptr<Mmap<char> > mmap_;
+  std::string             filename_;
+  whatlog                 what_;
+};
 }
 #endif  // MECAB_DICTIONARY_H_
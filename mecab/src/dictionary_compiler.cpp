@@ -46,8 +46,16 @@ class DictionaryComplier {
         MECAB_DEFAULT_CHARSET ")"  },
       { "wakati",    'w',  0,   0,   "build wakati-gaki only dictionary", },
       { "posid",     'p',  0,   0,   "assign Part-of-speech id" },
+      { "feature-columns", 'l', 0, 0,
+        "store pre-split feature columns for fast %f[N] output" },
+      { "compact-trie", 'k', 0, 0,
+        "store the double-array in the compact 32-bit layout" },
+      { "compress-matrix", 'z', 0, 0,
+        "compress matrix.bin with shared rows and 8-bit deltas" },
       { "node-format", 'F', 0,  "STR",
         "use STR as the user defined node format" },
+      { "bundle",    'b',  0,   "FILE",
+        "pack the system dictionary into FILE, which can be given as -d" },
       { "version",   'v',  0,   0,   "show the version and exit."  },
       { "help",      'h',  0,   0,   "show this help and exit."  },
       { 0, 0, 0, 0 }
@@ -75,6 +83,7 @@ class DictionaryComplier {
     bool opt_assign_user_dictionary_costs = param.get<bool>
         ("assign-user-dictionary-costs");
     const std::string userdic = param.get<std::string>("userdic");
+    const std::string bundle = param.get<std::string>("bundle");
 
 #define DCONF(file) create_filename(dicdir, std::string(file)).c_str()
 #define OCONF(file) create_filename(outdir, std::string(file)).c_str()
@@ -89,6 +98,9 @@ class DictionaryComplier {
       dic = param.rest_args();
     }
 
+    CHECK_DIE(userdic.empty() || bundle.empty())
+        << "user dictionaries cannot be bundled";
+
     if (!userdic.empty()) {
       CHECK_DIE(dic.size()) << "no dictionaries are specified";
       param.set("type", static_cast<int>(MECAB_USR_DIC));
@@ -137,7 +149,19 @@ class DictionaryComplier {
 
       if (opt_matrix) {
         Connector::compile(DCONF(MATRIX_DEF_FILE),
-                           OCONF(MATRIX_FILE));
+                           OCONF(MATRIX_FILE),
+                           param.get<bool>("compress-matrix"));
+      }
+
+      if (!bundle.empty()) {
+        const char *files[] = { DICRC, SYS_DIC_FILE, UNK_DIC_FILE,
+                                CHAR_PROPERTY_FILE, MATRIX_FILE };
+        std::vector<std::string> names, paths;
+        for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+          names.push_back(files[i]);
+          paths.push_back(i == 0 ? DCONF(files[i]) : OCONF(files[i]));
+        }
+        Bundle::compile(names, paths, bundle.c_str());
       }
     }
 
@@ -13,30 +13,65 @@
 
 namespace MeCab {
 
+// Blocks grow geometrically, from the size given to the constructor up
+// to kMaxGrowth times of it, so that a long sentence takes a few large
+// blocks instead of many small ones. free() keeps the blocks for reuse;
+// trim() releases all but the first one.
+const size_t kFreeListMaxGrowth = 64;
+
 template <class T> class FreeList {
  private:
-  std::vector<T *> freeList;
+  std::vector<std::pair<size_t, T *> > freeList;
   size_t           pi_;
   size_t           li_;
   size_t           size;
+  size_t           used_;
 
  public:
-  void free() { li_ = pi_ = 0; }
+  void free() {
+    li_ = pi_ = 0;
+    used_ = 0;
+  }
 
   T* alloc() {
-    if (pi_ == size) {
+    if (!freeList.empty() && pi_ == freeList[li_].first) {
+      used_ += pi_;
       li_++;
       pi_ = 0;
     }
-    if (li_ == freeList.size()) freeList.push_back(new T[size]);
-    return freeList[li_] + (pi_++);
+    if (li_ == freeList.size()) {
+      const size_t block_size = freeList.empty() ? size :
+          std::min(2 * freeList.back().first, size * kFreeListMaxGrowth);
+      freeList.push_back(std::make_pair(block_size, new T[block_size]));
+    }
+    return freeList[li_].second + (pi_++);
+  }
+
+  // Releases the blocks but the first. Call it after free().
+  void trim() {
+    for (size_t i = 1; i < freeList.size(); ++i) {
+      delete [] freeList[i].second;
+    }
+    freeList.resize(std::min(freeList.size(), static_cast<size_t>(1)));
+  }
+
+  // number of elements in the blocks.
+  size_t reserved_size() const {
+    size_t n = 0;
+    for (size_t i = 0; i < freeList.size(); ++i) {
+      n += freeList[i].first;
+    }
+    return n;
   }
 
-  explicit FreeList(size_t _size): pi_(0), li_(0), size(_size) {}
+  // number of elements allocated since the last free().
+  size_t used_size() const { return used_ + pi_; }
+
+  explicit FreeList(size_t _size): pi_(0), li_(0), size(_size), used_(0) {}
 
   virtual ~FreeList() {
     for (li_ = 0; li_ < freeList.size(); li_++)
-      delete [] freeList[li_];
+      delete [] freeList[li_].second;
   }
 };
 
@@ -46,9 +81,13 @@ template <class T> class ChunkFreeList {
   size_t pi_;
   size_t li_;
   size_t default_size;
+  size_t used_;
 
  public:
-  void free() { li_ = pi_ = 0; }
+  void free() {
+    li_ = pi_ = 0;
+    used_ = 0;
+  }
 
   T* alloc(T *src) {
     T* n = alloc(1);
@@ -57,6 +96,7 @@ template <class T> class ChunkFreeList {
   }
 
   T* alloc(size_t req = 1) {
+    used_ += req;
     while (li_ < freelist_.size()) {
       if ((pi_ + req) < freelist_[li_].first) {
         T *r = freelist_[li_].second + pi_;
@@ -66,15 +106,38 @@ template <class T> class ChunkFreeList {
       li_++;
       pi_ = 0;
     }
-    size_t _size = std::max(req, default_size);
+    const size_t block_size = freelist_.empty() ? default_size :
+        std::min(2 * freelist_.back().first,
+                 default_size * kFreeListMaxGrowth);
+    const size_t _size = std::max(req, block_size);
     freelist_.push_back(std::make_pair(_size, new T[_size]));
     li_ = freelist_.size() - 1;
     pi_ += req;
     return freelist_[li_].second;
   }
 
+  // Releases the blocks but the first. Call it after free().
+  void trim() {
+    for (size_t i = 1; i < freelist_.size(); ++i) {
+      delete [] freelist_[i].second;
+    }
+    freelist_.resize(std::min(freelist_.size(), static_cast<size_t>(1)));
+  }
+
+  // number of elements in the blocks.
+  size_t reserved_size() const {
+    size_t n = 0;
+    for (size_t i = 0; i < freelist_.size(); ++i) {
+      n += freelist_[i].first;
+    }
+    return n;
+  }
+
+  // number of elements allocated since the last free().
+  size_t used_size() const { return used_; }
+
   explicit ChunkFreeList(size_t _size):
-      pi_(0), li_(0), default_size(_size) {}
+      pi_(0), li_(0), default_size(_size), used_(0) {}
 
   virtual ~ChunkFreeList() {
     for (li_ = 0; li_ < freelist_.size(); li_++)
@@ -92,6 +92,7 @@ class CRFLearner {
     const size_t unk_eval_size = param->get<size_t>("unk-eval-size");
     const size_t thread_num = param->get<size_t>("thread");
     const size_t freq = param->get<size_t>("freq");
+    const bool fast_exp = param->get<bool>("fast-exp");
 
     CHECK_DIE(C > 0) << "cost parameter is out of range: " << C;
     CHECK_DIE(eta > 0) "eta is out of range: " << eta;
@@ -118,7 +119,8 @@ class CRFLearner {
                              &allocator,
                              &feature_index,
                              eval_size,
-                             unk_eval_size));
+                             unk_eval_size,
+                             fast_exp));
 
       CHECK_DIE(tagger->read(&ifs, &observed));
 
@@ -292,6 +294,8 @@ class Learner {
       { "eta",      'e',  "0.00005", "DIR",
         "set FLOAT for tolerance of termination criterion" },
       { "thread",   'p',  "1",     "INT",    "number of threads(default 1)" },
+      { "fast-exp", 'x',  0,       0,
+        "approximate exp() in the gradient (faster, less accurate)" },
       { "version",  'v',  0,   0,  "show the version and exit"  },
       { "help",     'h',  0,   0,  "show this help and exit."      },
       { 0, 0, 0, 0 }
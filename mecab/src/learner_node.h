@@ -7,6 +7,7 @@
 #define MECAB_LEARNER_NODE_H_
 
 #include <cstring>
+#include <vector>
 #include "mecab.h"
 #include "common.h"
 #include "utils.h"
@@ -112,22 +113,26 @@ inline void calc_expectation(LearnerPath *path, double *expected, double Z) {
   }
 }
 
-inline void calc_alpha(LearnerNode *n) {
-  n->alpha = 0.0;
+// |score| is a scratch buffer for the batched logsumexp(). exp() is
+// approximated if |fast_exp| is true.
+inline void calc_alpha(LearnerNode *n, std::vector<double> *score,
+                       bool fast_exp) {
+  score->clear();
   for (LearnerPath *path = n->lpath; path; path = path->lnext) {
-    n->alpha = logsumexp(n->alpha,
-                         path->cost + path->lnode->alpha,
-                         path == n->lpath);
+    score->push_back(path->cost + path->lnode->alpha);
   }
+  n->alpha = score->empty() ? 0.0 :
+      logsumexp(&(*score)[0], score->size(), fast_exp);
 }
 
-inline void calc_beta(LearnerNode *n) {
-  n->beta = 0.0;
+inline void calc_beta(LearnerNode *n, std::vector<double> *score,
+                      bool fast_exp) {
+  score->clear();
   for (LearnerPath *path = n->rpath; path; path = path->rnext) {
-    n->beta = logsumexp(n->beta,
-                        path->cost + path->rnode->beta,
-                        path == n->rpath);
+    score->push_back(path->cost + path->rnode->beta);
   }
+  n->beta = score->empty() ? 0.0 :
+      logsumexp(&(*score)[0], score->size(), fast_exp);
 }
 }
 
@@ -31,13 +31,15 @@ bool EncoderLearnerTagger::open(Tokenizer<LearnerNode, LearnerPath> *tokenizer,
                                 Allocator<LearnerNode, LearnerPath> *allocator,
                                 FeatureIndex               *feature_index,
                                 size_t eval_size,
-                                size_t unk_eval_size) {
+                                size_t unk_eval_size,
+                                bool fast_exp) {
   close();
   tokenizer_      = tokenizer;
   allocator_      = allocator;
   feature_index_  = feature_index;
   eval_size_      = eval_size;
   unk_eval_size_  = unk_eval_size;
+  fast_exp_       = fast_exp;
   return true;
 }
 
@@ -389,13 +391,13 @@ double EncoderLearnerTagger::gradient(double *expected) {
 
   for (int pos = 0;   pos <= static_cast<long>(len_);  ++pos) {
     for (LearnerNode *node = begin_node_list_[pos]; node; node = node->bnext) {
-      calc_alpha(node);
+      calc_alpha(node, &score_, fast_exp_);
     }
   }
 
   for (int pos = static_cast<long>(len_); pos >=0;    --pos) {
     for (LearnerNode *node = end_node_list_[pos]; node; node = node->enext) {
-      calc_beta(node);
+      calc_beta(node, &score_, fast_exp_);
     }
   }
 
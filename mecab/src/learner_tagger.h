@@ -51,17 +51,21 @@ class EncoderLearnerTagger: public LearnerTagger {
   bool open(Tokenizer<LearnerNode, LearnerPath> *tokenzier,
             Allocator<LearnerNode, LearnerPath> *allocator,
             FeatureIndex *feature_index,
-            size_t eval_size, size_t unk_eval_size);
+            size_t eval_size, size_t unk_eval_size,
+            bool fast_exp);
   bool read(std::istream *, std::vector<double> *);
   int eval(size_t *, size_t *, size_t *) const;
   double gradient(double *expected);
-  explicit EncoderLearnerTagger(): eval_size_(1024), unk_eval_size_(1024) {}
+  explicit EncoderLearnerTagger(): eval_size_(1024), unk_eval_size_(1024),
+                                   fast_exp_(false) {}
   virtual ~EncoderLearnerTagger() { close(); }
 
  private:
   size_t eval_size_;
   size_t unk_eval_size_;
+  bool fast_exp_;
   std::vector<LearnerPath *> ans_path_list_;
+  std::vector<double> score_;
 };
 
 class DecoderLearnerTagger: public LearnerTagger {
@@ -181,6 +181,13 @@ char* mecab_sparse_tostr3(mecab_t *tagger, const char *str, size_t len,
           str, len, out, len2));
 }
 
+int mecab_parse_batch(mecab_t *tagger, const char **str, const size_t *len,
+                      size_t n, const char **results) {
+  return static_cast<int>(
+      reinterpret_cast<MeCab::Tagger *>(tagger)->parseBatch(
+          str, len, n, results));
+}
+
 const mecab_node_t* mecab_sparse_tonode(mecab_t *tagger, const char *str) {
   return reinterpret_cast<const mecab_node_t *>(
       reinterpret_cast<MeCab::Tagger *>(tagger)->parseToNode(str));
@@ -432,6 +439,11 @@ const char *mecab_lattice_strerror(mecab_lattice_t *lattice) {
   return reinterpret_cast<MeCab::Lattice *>(lattice)->what();
 }
 
+void mecab_lattice_memory_stat(mecab_lattice_t *lattice,
+                               size_t *reserved, size_t *used) {
+  reinterpret_cast<MeCab::Lattice *>(lattice)->memory_stat(reserved, used);
+}
+
 mecab_model_t *mecab_model_new(int argc, char **argv) {
   MeCab::Model *model = MeCab::createModel(argc, argv);
   if (!model) {
@@ -472,6 +484,11 @@ int mecab_model_swap(mecab_model_t *model, mecab_model_t *new_model) {
           reinterpret_cast<MeCab::Model *>(new_model)));
 }
 
+void mecab_model_result_cache_stat(mecab_model_t *model,
+                                   size_t *hits, size_t *misses) {
+  reinterpret_cast<MeCab::Model *>(model)->result_cache_stat(hits, misses);
+}
+
 const mecab_dictionary_info_t* mecab_model_dictionary_info(
     mecab_model_t *model) {
   return reinterpret_cast<const mecab_dictionary_info_t *>(
@@ -494,3 +511,24 @@ mecab_node_t *mecab_model_lookup(mecab_model_t *model,
           begin, end,
           reinterpret_cast<MeCab::Lattice *>(lattice)));
 }
+
+mecab_pool_t *mecab_model_new_pool(mecab_model_t *model,
+                                   size_t n, int replicate) {
+  return reinterpret_cast<mecab_pool_t *>(
+      reinterpret_cast<MeCab::Model *>(model)->createPool(
+          n, static_cast<bool>(replicate)));
+}
+
+void mecab_pool_destroy(mecab_pool_t *pool) {
+  delete reinterpret_cast<MeCab::TaggerPool *>(pool);
+}
+
+mecab_t *mecab_pool_tagger(mecab_pool_t *pool, size_t i) {
+  return reinterpret_cast<mecab_t *>(
+      reinterpret_cast<MeCab::TaggerPool *>(pool)->tagger(i));
+}
+
+mecab_lattice_t *mecab_pool_lattice(mecab_pool_t *pool, size_t i) {
+  return reinterpret_cast<mecab_lattice_t *>(
+      reinterpret_cast<MeCab::TaggerPool *>(pool)->lattice(i));
+}
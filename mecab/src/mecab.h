@@ -301,7 +301,33 @@ enum {
    * When this flag is set, tagger internally copies the body of passed
    * sentence into internal buffer.
    */
-  MECAB_ALLOCATE_SENTENCE = 64
+  MECAB_ALLOCATE_SENTENCE = 64,
+
+  /**
+   * Set this flag if you want to bound the search.
+   * Only the best N nodes (by accumulated cost) ending at each position
+   * are connected to the next words, where N is given by the --beam option.
+   * The result may differ from the exact 1-best result.
+   * This flag is ignored in MECAB_NBEST and MECAB_MARGINAL_PROB modes.
+   */
+  MECAB_BEAM              = 128,
+
+  /**
+   * Set this flag with MECAB_MARGINAL_PROB to compute the marginal
+   * probabilities without making the Path objects between the nodes.
+   * Node::alpha, beta and prob are set as usual, but Node::lpath and
+   * rpath are NULL. This flag is ignored in MECAB_NBEST mode.
+   */
+  MECAB_MARGINAL_WITHOUT_PATH = 256,
+
+  /**
+   * Set this flag with MECAB_NBEST to enumerate segmentations: each
+   * is returned once, and the paths which differ only in the features
+   * of the morphemes are skipped. The features of each segmentation
+   * are chosen from EOS by the best path from each morpheme, so they
+   * may not be the best ones of that segmentation.
+   */
+  MECAB_NBEST_UNIQUE      = 512
 };
 
 /**
@@ -356,6 +382,7 @@ extern "C" {
   typedef struct mecab_t                 mecab_t;
   typedef struct mecab_model_t           mecab_model_t;
   typedef struct mecab_lattice_t         mecab_lattice_t;
+  typedef struct mecab_pool_t            mecab_pool_t;
   typedef struct mecab_dictionary_info_t mecab_dictionary_info_t;
   typedef struct mecab_node_t            mecab_node_t;
   typedef struct mecab_path_t            mecab_path_t;
@@ -450,6 +477,12 @@ extern "C" {
   MECAB_DLL_EXTERN char*         mecab_sparse_tostr3(mecab_t *mecab, const char *str, size_t len,
                                                      char *ostr, size_t olen);
 
+  /**
+   * C wrapper of MeCab::Tagger::parseBatch(const char **str, const size_t *len, size_t n, const char **results)
+   */
+  MECAB_DLL_EXTERN int           mecab_parse_batch(mecab_t *mecab, const char **str, const size_t *len,
+                                                   size_t n, const char **results);
+
   /**
    * C wrapper of MeCab::Tagger::parseToNode(const char *str)
    */
@@ -700,6 +733,12 @@ extern "C" {
    */
   MECAB_DLL_EXTERN const char      *mecab_lattice_strerror(mecab_lattice_t *lattice);
 
+  /**
+   * C wrapper of MeCab::Lattice::memory_stat()
+   */
+  MECAB_DLL_EXTERN void            mecab_lattice_memory_stat(mecab_lattice_t *lattice,
+                                                             size_t *reserved, size_t *used);
+
 
   /* model interface */
   /**
@@ -733,6 +772,12 @@ extern "C" {
    */
   MECAB_DLL_EXTERN int mecab_model_swap(mecab_model_t *model, mecab_model_t *new_model);
 
+  /**
+   * C wrapper of MeCab::Model::result_cache_stat()
+   */
+  MECAB_DLL_EXTERN void mecab_model_result_cache_stat(mecab_model_t *model,
+                                                      size_t *hits, size_t *misses);
+
   /**
    * C wapper of MeCab::Model::dictionary_info()
    */
@@ -753,6 +798,28 @@ extern "C" {
                                                     const char *end,
                                                     mecab_lattice_t *lattice);
 
+  /**
+   * C wrapper of MeCab::Model::createPool(n, replicate)
+   */
+  MECAB_DLL_EXTERN mecab_pool_t    *mecab_model_new_pool(mecab_model_t *model,
+                                                         size_t n, int replicate);
+
+  /* pool interface */
+  /**
+   * C wrapper of delete pool
+   */
+  MECAB_DLL_EXTERN void             mecab_pool_destroy(mecab_pool_t *pool);
+
+  /**
+   * C wrapper of MeCab::TaggerPool::tagger(i)
+   */
+  MECAB_DLL_EXTERN mecab_t         *mecab_pool_tagger(mecab_pool_t *pool, size_t i);
+
+  /**
+   * C wrapper of MeCab::TaggerPool::lattice(i)
+   */
+  MECAB_DLL_EXTERN mecab_lattice_t *mecab_pool_lattice(mecab_pool_t *pool, size_t i);
+
   /* static functions */
   MECAB_DLL_EXTERN int           mecab_do(int argc, char **argv);
   MECAB_DLL_EXTERN int           mecab_dict_index(int argc, char **argv);
@@ -776,6 +843,7 @@ typedef struct mecab_node_t            Node;
 
 template <typename N, typename P> class Allocator;
 class Tagger;
+class TaggerPool;
 
 /**
  * Lattice class
@@ -1050,6 +1118,15 @@ public:
    */
   virtual void set_what(const char *str)        = 0;
 
+  /**
+   * Return the memory the lattice keeps for its nodes, paths, strings,
+   * search scratch and output. The memory is kept for the next sentences, unless
+   * --trim-memory limits it.
+   * @param reserved bytes kept by the lattice
+   * @param used bytes used by the current sentence
+   */
+  virtual void memory_stat(size_t *reserved, size_t *used) const = 0;
+
 #ifndef SWIG
   /**
    * Create new Lattice object
@@ -1101,6 +1178,21 @@ public:
    */
   virtual Lattice *createLattice() const = 0;
 
+  /**
+   * Create a pool of |n| Tagger/Lattice pairs, one for each worker thread.
+   * The pair of a slot is created by the first call of TaggerPool::tagger()
+   * or TaggerPool::lattice() from the thread which uses the slot, so that
+   * its memory is first touched on the NUMA node of that thread.
+   * If |replicate| is true, the dictionaries and the connection matrix are
+   * also read into memory once per NUMA node, and each slot uses the copy of
+   * its node. The copies are NOT updated by swap().
+   * Never delete this model object before deleting the pool.
+   * @return new TaggerPool object
+   * @param n number of slots
+   * @param replicate copy the dictionaries to every NUMA node
+   */
+  virtual TaggerPool *createPool(size_t n, bool replicate = false) const = 0;
+
   /**
    * Swap the instance with |model|.
    * The ownership of |model| always moves to this instance,
@@ -1114,6 +1206,16 @@ public:
    */
   virtual bool swap(Model *model) = 0;
 
+  /**
+   * Return the number of lookups that found and did not find a
+   * result in the result cache (--result-cache). Both are 0 when the
+   * cache is disabled. swap() empties the cache but keeps the counts.
+   * This method is thread safe.
+   * @param hits number of sentences answered from the cache
+   * @param misses number of sentences parsed
+   */
+  virtual void result_cache_stat(size_t *hits, size_t *misses) const = 0;
+
   /**
    * Return a version string
    * @return version string
@@ -1270,6 +1372,22 @@ public:
    */
   virtual const char* parse(const char *str, size_t len)                          = 0;
 
+  /**
+   * Parse |n| sentences at once. The lattice, its node allocator and the
+   * output buffer are reused across the batch, and the model is locked
+   * only once, so this is much cheaper than calling parse() |n| times.
+   * On success, results[i] points to the parsed result of str[i].
+   * All the results are invalidated by the next call to this tagger.
+   * This method is NOT thread safe.
+   * @param str array of sentences
+   * @param len array of sentence lengths
+   * @param n number of sentences
+   * @param results array of |n| pointers which receives the parsed results
+   * @return boolean
+   */
+  virtual bool parseBatch(const char **str, const size_t *len,
+                          size_t n, const char **results)                    = 0;
+
   /**
    * The same as parseToNode(), but input lenth can be passed.
    * @param str sentence
@@ -1440,6 +1558,48 @@ public:
   static const char *version();
 };
 
+/**
+ * TaggerPool class
+ */
+class MECAB_DLL_CLASS_EXTERN TaggerPool {
+public:
+  /**
+   * Return the number of slots.
+   * @return number of slots
+   */
+  virtual size_t size() const = 0;
+
+  /**
+   * Return the tagger of the i-th slot, creating the slot on the first call.
+   * A slot must be used by one thread only, and should be created from it.
+   * Return NULL if |i| is out of range or the slot cannot be created.
+   * Use MeCab::getLastError() to obtain the cause of the errors.
+   * The pool keeps the ownership of the returned object.
+   * This method is thread safe as long as |i| differs between threads.
+   * @return Tagger object
+   * @param i slot index
+   */
+  virtual Tagger  *tagger(size_t i) = 0;
+
+  /**
+   * Return the lattice of the i-th slot, creating the slot on the first call.
+   * The same rules as tagger() apply.
+   * @return Lattice object
+   * @param i slot index
+   */
+  virtual Lattice *lattice(size_t i) = 0;
+
+  /**
+   * Return the NUMA node the i-th slot was created on, or -1 if the slot
+   * is not created yet.
+   * @return NUMA node
+   * @param i slot index
+   */
+  virtual int node(size_t i) const = 0;
+
+  virtual ~TaggerPool() {}
+};
+
 #ifndef SWIG
 /**
  * Alias of Lattice::create()
@@ -54,6 +54,10 @@ extern "C" {
 #define O_BINARY 0
 #endif
 
+#if defined(HAVE_MMAP) && !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
 namespace MeCab {
 
 template <class T> class Mmap {
@@ -62,6 +66,11 @@ template <class T> class Mmap {
   size_t       length;
   std::string  fileName;
   whatlog what_;
+  bool         copy;      // |text| is a private copy of the file
+  bool         prefault;
+  bool         hugepage;
+  bool         view;      // |text| is owned by someone else
+  size_t       capacity;  // bytes allocated for the copy
 
 #if defined(_WIN32) && !defined(__CYGWIN__)
   HANDLE hFile;
@@ -81,9 +90,30 @@ template <class T> class Mmap {
   size_t size()               { return length/sizeof(T); }
   const char *what()          { return what_.str(); }
   const char *file_name()     { return fileName.c_str(); }
-  size_t file_size()          { return length; }
+  size_t file_size()    const { return length; }
   bool empty()                { return(length == 0); }
 
+  // Uses |size| bytes at |ptr|, which are owned by another object,
+  // e.g. a section of a dictionary bundle. close() leaves them alone.
+  void attach(const char *filename, T *ptr, size_t size) {
+    this->close();
+    fileName = std::string(filename);
+    text = ptr;
+    length = size;
+    view = true;
+  }
+
+  // A mode is "r" or "r+", followed by any of these modifiers:
+  //
+  //  p  read the file into memory allocated by the calling thread
+  //     instead of mapping it, so the pages are local to its NUMA node
+  //     rather than shared through the page cache (read-only)
+  //  f  fault all the pages in when the file is opened, so the first
+  //     lookups do not stall on page faults
+  //  h  ask for transparent huge pages. A copy is placed in 2MB-aligned
+  //     anonymous memory; a mapping of the page cache gets the advice
+  //     only, which few kernels honor for files.
+  //
   // This code is imported from sufary, develoved by
   //  TATUO Yamashita <yto@nais.to> Thanks!
 #if defined(_WIN32) && !defined(__CYGWIN__)
@@ -92,14 +122,17 @@ template <class T> class Mmap {
     unsigned long mode1, mode2, mode3;
     fileName = std::string(filename);
 
-    if (std::strcmp(mode, "r") == 0) {
-      mode1 = GENERIC_READ;
-      mode2 = PAGE_READONLY;
-      mode3 = FILE_MAP_READ;
-    } else if (std::strcmp(mode, "r+") == 0) {
+    if (std::strncmp(mode, "r+", 2) == 0) {
       mode1 = GENERIC_READ | GENERIC_WRITE;
       mode2 = PAGE_READWRITE;
       mode3 = FILE_MAP_ALL_ACCESS;
+      set_modifiers(mode + 2);
+      CHECK_FALSE(!copy) << "cannot write a copy: " << filename;
+    } else if (mode[0] == 'r') {
+      mode1 = GENERIC_READ;
+      mode2 = PAGE_READONLY;
+      mode3 = FILE_MAP_READ;
+      set_modifiers(mode + 1);
     } else {
       CHECK_FALSE(false) << "unknown open mode:" << filename;
     }
@@ -111,17 +144,44 @@ template <class T> class Mmap {
 
     length = ::GetFileSize(hFile, 0);
 
+    if (copy) {
+      char *p = new char[length];
+      text = reinterpret_cast<T *>(p);
+      DWORD n = 0;
+      CHECK_FALSE(::ReadFile(hFile, p, length, &n, 0) && n == length)
+          << "ReadFile() failed: " << filename;
+      ::CloseHandle(hFile);
+      hFile = INVALID_HANDLE_VALUE;
+      return true;
+    }
+
     hMap = ::CreateFileMapping(hFile, 0, mode2, 0, 0, 0);
     CHECK_FALSE(hMap) << "CreateFileMapping() failed: " << filename;
 
     text = reinterpret_cast<T *>(::MapViewOfFile(hMap, mode3, 0, 0, 0));
     CHECK_FALSE(text) << "MapViewOfFile() failed: " << filename;
 
+    // Large pages need a privilege on Windows, so 'h' is ignored.
+    if (prefault) {
+      touch();
+    }
+
     return true;
   }
 
   void close() {
-    if (text) { ::UnmapViewOfFile(text); }
+    if (view) {
+      text = 0;
+      view = false;
+      return;
+    }
+    if (text) {
+      if (copy) {
+        delete [] reinterpret_cast<char *>(text);
+      } else {
+        ::UnmapViewOfFile(text);
+      }
+    }
     if (hFile != INVALID_HANDLE_VALUE) {
       ::CloseHandle(hFile);
       hFile = INVALID_HANDLE_VALUE;
@@ -133,7 +193,9 @@ template <class T> class Mmap {
     text = 0;
   }
 
-  Mmap(): text(0), hFile(INVALID_HANDLE_VALUE), hMap(0) {}
+  Mmap(): text(0), copy(false), prefault(false), hugepage(false),
+          view(false), capacity(0),
+          hFile(INVALID_HANDLE_VALUE), hMap(0) {}
 
 #else
 
@@ -142,12 +204,16 @@ template <class T> class Mmap {
     struct stat st;
     fileName = std::string(filename);
 
-    if      (std::strcmp(mode, "r") == 0)
-      flag = O_RDONLY;
-    else if (std::strcmp(mode, "r+") == 0)
+    if (std::strncmp(mode, "r+", 2) == 0) {
       flag = O_RDWR;
-    else
+      set_modifiers(mode + 2);
+      CHECK_FALSE(!copy) << "cannot write a copy: " << filename;
+    } else if (mode[0] == 'r') {
+      flag = O_RDONLY;
+      set_modifiers(mode + 1);
+    } else {
       CHECK_FALSE(false) << "unknown open mode: " << filename;
+    }
 
     CHECK_FALSE((fd = ::open(filename, flag | O_BINARY)) >= 0)
         << "open failed: " << filename;
@@ -158,15 +224,43 @@ template <class T> class Mmap {
     length = st.st_size;
 
 #ifdef HAVE_MMAP
+    if (copy) {
+      char *p = allocate();
+      CHECK_FALSE(p) << "mmap() failed: " << filename;
+      text = reinterpret_cast<T *>(p);
+      for (size_t n = 0; n < length;) {
+        const ssize_t r = ::read(fd, p + n, length - n);
+        CHECK_FALSE(r > 0) << "read() failed: " << filename;
+        n += r;
+      }
+      ::close(fd);
+      fd = -1;
+      return true;
+    }
+
     int prot = PROT_READ;
     if (flag == O_RDWR) prot |= PROT_WRITE;
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (prefault) flags |= MAP_POPULATE;
+#endif
     char *p;
     CHECK_FALSE((p = reinterpret_cast<char *>
-                 (::mmap(0, length, prot, MAP_SHARED, fd, 0)))
+                 (::mmap(0, length, prot, flags, fd, 0)))
                 != MAP_FAILED)
         << "mmap() failed: " << filename;
 
     text = reinterpret_cast<T *>(p);
+
+#ifdef MADV_HUGEPAGE
+    if (hugepage) ::madvise(p, length, MADV_HUGEPAGE);
+#endif
+#ifdef MADV_WILLNEED
+    if (prefault) ::madvise(p, length, MADV_WILLNEED);
+#endif
+#ifndef MAP_POPULATE
+    if (prefault) touch();
+#endif
 #else
     text = new T[length];
     CHECK_FALSE(::read(fd, text, length) >= 0)
@@ -179,6 +273,11 @@ template <class T> class Mmap {
   }
 
   void close() {
+    if (view) {
+      text = 0;
+      view = false;
+      return;
+    }
     if (fd >= 0) {
       ::close(fd);
       fd = -1;
@@ -186,7 +285,7 @@ template <class T> class Mmap {
 
     if (text) {
 #ifdef HAVE_MMAP
-      ::munmap(reinterpret_cast<char *>(text), length);
+      ::munmap(reinterpret_cast<char *>(text), copy ? capacity : length);
       text = 0;
 #else
       if (flag == O_RDWR) {
@@ -203,8 +302,62 @@ template <class T> class Mmap {
     text = 0;
   }
 
-  Mmap() : text(0), fd(-1) {}
+  Mmap() : text(0), copy(false), prefault(false), hugepage(false),
+           view(false), capacity(0), fd(-1) {}
+#endif
+
+#ifdef HAVE_MMAP
+ private:
+  static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+  // Maps anonymous memory for a copy of the file. With |hugepage|,
+  // the block is aligned to kHugePageSize and sized in whole huge pages.
+  char *allocate() {
+    const size_t align = hugepage ? kHugePageSize : 1;
+    capacity = ((length ? length : 1) + align - 1) / align * align;
+    const size_t extra = hugepage ? kHugePageSize : 0;
+    char *p = reinterpret_cast<char *>(
+        ::mmap(0, capacity + extra, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (p == MAP_FAILED) {
+      return 0;
+    }
+    if (extra) {
+      char *begin = p + (kHugePageSize -
+                         reinterpret_cast<size_t>(p) % kHugePageSize) %
+          kHugePageSize;
+      if (begin > p) {
+        ::munmap(p, begin - p);
+      }
+      if (begin + capacity < p + capacity + extra) {
+        ::munmap(begin + capacity, p + extra - begin);
+      }
+      p = begin;
+    }
+#ifdef MADV_HUGEPAGE
+    if (hugepage) ::madvise(p, capacity, MADV_HUGEPAGE);
 #endif
+    return p;
+  }
+#endif
+
+ private:
+  void set_modifiers(const char *modifiers) {
+    copy     = (std::strchr(modifiers, 'p') != 0);
+    prefault = (std::strchr(modifiers, 'f') != 0);
+    hugepage = (std::strchr(modifiers, 'h') != 0);
+  }
+
+  // Reads a byte of every page.
+  void touch() const {
+    const char *p = reinterpret_cast<const char *>(text);
+    volatile char sum = 0;
+    for (size_t i = 0; i < length; i += 4096) {
+      sum += p[i];
+    }
+  }
+
+ public:
 
   virtual ~Mmap() { this->close(); }
 };
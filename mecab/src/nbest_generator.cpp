@@ -3,31 +3,101 @@
 //
 //  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <algorithm>
 #include <queue>
 #include "mecab.h"
 #include "nbest_generator.h"
 
 namespace MeCab {
 
+namespace {
+// the cost of the best path from BOS through |path|. Ties keep the
+// order of the lpath list.
+bool path_less(const Path *path1, const Path *path2) {
+  return path1->lnode->cost + path1->cost <
+      path2->lnode->cost + path2->cost;
+}
+}  // namespace
+
 bool NBestGenerator::set(Lattice *lattice) {
   freelist_.free();
   while (!agenda_.empty()) {
     agenda_.pop();   // make empty
   }
+  paths_.clear();
+  path_begin_.clear();
+  path_size_.clear();
+  unique_ = lattice->has_request_type(MECAB_NBEST_UNIQUE);
+
   QueueElement *eos = freelist_.alloc();
   eos->node = lattice->eos_node();
   eos->next = 0;
   eos->fx = eos->gx = 0;
+  eos->index = 0;
   agenda_.push(eos);
   return true;
 }
 
+Path **NBestGenerator::sorted_paths(Node *node, unsigned int *size) {
+  if (node->id >= path_begin_.size()) {
+    path_begin_.resize(node->id + 1, -1);
+    path_size_.resize(node->id + 1, 0);
+  }
+  if (path_begin_[node->id] < 0) {
+    const size_t begin = paths_.size();
+    for (Path *path = node->lpath; path; path = path->lnext) {
+      paths_.push_back(path);
+    }
+    std::stable_sort(paths_.begin() + begin, paths_.end(), path_less);
+    if (unique_) {
+      // drops the paths from a span which has a better one.
+      size_t end = begin;
+      for (size_t i = begin; i < paths_.size(); ++i) {
+        size_t j = begin;
+        while (j < end &&
+               paths_[j]->lnode->rlength != paths_[i]->lnode->rlength) {
+          ++j;
+        }
+        if (j == end) {
+          paths_[end++] = paths_[i];
+        }
+      }
+      paths_.resize(end);
+    }
+    path_begin_[node->id] = static_cast<int>(begin);
+    path_size_[node->id] = static_cast<unsigned int>(paths_.size() - begin);
+  }
+  *size = path_size_[node->id];
+  return *size ? &paths_[path_begin_[node->id]] : 0;
+}
+
+// pushes |parent| extended with its |index|-th left path, if any.
+void NBestGenerator::push(QueueElement *parent, unsigned int index) {
+  unsigned int size = 0;
+  Path **paths = sorted_paths(parent->node, &size);
+  if (index >= size) {
+    return;
+  }
+  const Path *path = paths[index];
+  QueueElement *n = freelist_.alloc();
+  n->node = path->lnode;
+  n->gx = path->cost + parent->gx;
+  n->fx = path->lnode->cost + path->cost + parent->gx;
+  n->next = parent;
+  n->index = index;
+  agenda_.push(n);
+}
+
 bool NBestGenerator::next() {
   while (!agenda_.empty()) {
     QueueElement *top = agenda_.top();
     agenda_.pop();
     Node *rnode = top->node;
 
+    if (top->next) {
+      push(top->next, top->index + 1);
+    }
+
     if (rnode->stat == MECAB_BOS_NODE) {  // BOS
       for (QueueElement *n = top; n->next; n = n->next) {
         n->node->next = n->next->node;   // change next & prev
@@ -37,14 +107,7 @@ bool NBestGenerator::next() {
       return true;
     }
 
-    for (Path *path = rnode->lpath; path; path = path->lnext) {
-      QueueElement *n = freelist_.alloc();
-      n->node = path->lnode;
-      n->gx = path->cost + top->gx;
-      n->fx = path->lnode->cost + path->cost + top->gx;
-      n->next = top;
-      agenda_.push(n);
-    }
+    push(top, 0);
   }
 
   return false;
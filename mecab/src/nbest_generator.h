@@ -7,11 +7,32 @@
 #define MECAB_NBEST_GENERATOR_H_
 
 #include <queue>
+#include <vector>
 #include "mecab.h"
 #include "freelist.h"
 
 namespace MeCab {
 
+// Enumerates the paths of a lattice from the best, by A* search from
+// EOS with the costs of the forward pass as the (exact) heuristic.
+//
+// The search is lazy: the left paths of a node are sorted by the cost
+// through them when the node is first expanded, and an element popped
+// from the agenda pushes only its best extension and its next sibling,
+// i.e. the same parent extended with the next path in the order. Since
+// the heuristic is exact, each element popped before the N-th result
+// lies on one of the N best paths, so the agenda stays within
+// O(N * length) elements, while expanding every left path of every
+// popped node could make it grow by the number of paths per node.
+//
+// With MECAB_NBEST_UNIQUE, the left paths of a node keep only the best
+// path from each span, i.e. each rlength of the left node. Two paths
+// of the search then differ in their segmentations, and the search
+// enumerates segmentations rather than every choice of features for
+// them. The features of a segmentation are chosen greedily from EOS,
+// so a path returned may cost more than the best one of its
+// segmentation. The forward costs remain a lower bound, and the paths
+// still come out in the order of their costs.
 class NBestGenerator {
  private:
   struct QueueElement {
@@ -19,6 +40,7 @@ class NBestGenerator {
     QueueElement *next;
     long fx;  // f(x) = h(x) + g(x): cost function for A* search
     long gx;  // g(x)
+    unsigned int index;  // of the path to |node| in the list of |next|
   };
 
   class QueueElementComp {
@@ -32,11 +54,32 @@ class NBestGenerator {
                       QueueElementComp> agenda_;
   FreeList <QueueElement> freelist_;
 
+  // the left paths of the expanded nodes, sorted by lnode->cost +
+  // cost, at path_begin_[node->id] of paths_. -1 if not expanded yet.
+  std::vector<Path *> paths_;
+  std::vector<int> path_begin_;
+  std::vector<unsigned int> path_size_;
+
+  // MECAB_NBEST_UNIQUE: keep the best left path per span.
+  bool unique_;
+
+  Path **sorted_paths(Node *node, unsigned int *size);
+  void push(QueueElement *parent, unsigned int index);
+
  public:
-  explicit NBestGenerator() : freelist_(512) {}
+  explicit NBestGenerator() : freelist_(512), unique_(false) {}
   virtual ~NBestGenerator() {}
   bool set(Lattice *lattice);
   bool next();
+
+  // bytes of the elements and the sorted paths, not counting the
+  // agenda, which holds pointers to the elements.
+  size_t reserved_size() const {
+    return freelist_.reserved_size() * sizeof(QueueElement) +
+        paths_.capacity() * sizeof(Path *) +
+        path_begin_.capacity() * sizeof(int) +
+        path_size_.capacity() * sizeof(unsigned int);
+  }
 };
 }
 
@@ -68,8 +68,12 @@ bool Param::load(const char *filename) {
 
   CHECK_FALSE(ifs) << "no such file or directory: " << filename;
 
+  return load(&ifs);
+}
+
+bool Param::load(std::istream *is) {
   std::string line;
-  while (std::getline(ifs, line)) {
+  while (std::getline(*is, line)) {
     if (!line.size() ||
         (line.size() && (line[0] == ';' || line[0] == '#'))) continue;
 
@@ -189,6 +193,14 @@ void Param::clear() {
   rest_.clear();
 }
 
+void Param::copy(const Param &param) {
+  conf_        = param.conf_;
+  rest_        = param.rest_;
+  system_name_ = param.system_name_;
+  help_        = param.help_;
+  version_     = param.version_;
+}
+
 bool Param::open(const char *arg, const Option *opts) {
   scoped_fixed_array<char, BUF_SIZE> str;
   std::strncpy(str.get(), arg, str.size());
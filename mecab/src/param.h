@@ -55,11 +55,17 @@ class Param {
   bool open(int argc,  char **argv, const Option *opt);
   bool open(const char *arg,  const Option *opt);
   bool load(const char *filename);
+  // reads "key = value" lines from |is|, e.g. a dicrc in a bundle.
+  bool load(std::istream *is);
   void clear();
+  // copies everything but the error message.
+  void copy(const Param &param);
   const std::vector<std::string>& rest_args() const { return rest_; }
 
   const char* program_name() const { return system_name_.c_str(); }
   const char *what() { return what_.str(); }
+  // sets the error message of a caller which fails with this Param.
+  void set_what(const char *str) { what_.stream_ << str; }
   const char* help() const { return help_.c_str(); }
   const char* version() const { return version_.c_str(); }
   int help_version() const;
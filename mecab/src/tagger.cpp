@@ -3,12 +3,15 @@
 //
 //  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <iterator>
+#include <sstream>
 #include "common.h"
 #include "connector.h"
 #include "mecab.h"
+#include "mmap.h"
 #include "nbest_generator.h"
 #include "param.h"
 #include "scoped_ptr.h"
@@ -16,6 +19,7 @@
 #include "string_buffer.h"
 #include "thread.h"
 #include "tokenizer.h"
+#include "utils.h"
 #include "viterbi.h"
 #include "writer.h"
 
@@ -43,10 +47,16 @@ const MeCab::Option long_options[] = {
   { "all-morphs",      'a', 0, 0,    "output all morphs(default false)" },
   { "nbest",              'N', "1",
     "INT", "output N best results (default 1)" },
+  { "nbest-unique",       'k',  0, 0,
+    "skip the N best results of the same segmentation as a better one" },
   { "partial",            'p',  0, 0,
     "partial parsing mode (default false)" },
   { "marginal",           'm',  0, 0,
     "output marginal probability (default false)" },
+  { "marginal-without-path", 'Q', 0, 0,
+    "compute marginal probabilities without the paths, unless they are shown" },
+  { "fast-exp",           'X',  0, 0,
+    "approximate exp() in the marginal probabilities (faster, less accurate)" },
   { "max-grouping-size",  'M',  "24",
     "INT",  "maximum grouping size for unknown words (default 24)" },
   { "node-format",        'F',  "%m\\t%H\\n", "STR",
@@ -66,16 +76,221 @@ const MeCab::Option long_options[] = {
   { "dump-config", 'P', 0, 0, "dump MeCab parameters" },
   { "allocate-sentence",  'C', 0, 0,
     "allocate new memory for input sentence" },
+  { "align-matrix",  'A', 0, 0,
+    "copy the connection matrix into cache-line aligned rows" },
+  { "load-dictionary",  'L', 0, 0,
+    "read the dictionaries into memory instead of mapping them" },
+  { "prefault-dictionary",  'f', 0, 0,
+    "fault in the pages of the dictionaries when they are opened" },
+  { "hugepage-dictionary",  'H', 0, 0,
+    "ask for transparent huge pages for the dictionaries" },
+  { "result-cache",  'y',  "0",  "INT",
+    "cache the results of INT sentences per model (default 0)" },
+  { "trim-memory",  'G',  "0",  "INT",
+    "release the memory of a lattice above INT MB after a sentence (default 0)" },
+  { "lookup-cache",  'K',  "0",  "INT",
+    "cache the dictionary lookups of INT substrings per lattice (default 0)" },
+  { "beam",         'W',  "0",  "INT",
+    "keep only INT best nodes at each position (default 0, exact search)" },
+  { "beam-report",  'R',  0, 0,
+    "report how often --beam changes the 1-best result" },
   { "theta",        't',  "0.75",  "FLOAT",
     "set temparature parameter theta (default 0.75)"  },
   { "cost-factor",        'c',  "700",  "INT",
     "set cost factor (default 700)"  },
+  { "threads",       'T',  "1",  "INT",
+    "use INT threads to parse the input (default 1)" },
+  { "stream",        's',  0, 0,
+    "analyze long lines incrementally in a window of input-buffer-size" },
   { "output",        'o',  0,    "FILE",  "set the output file name" },
   { "version",        'v',  0, 0,     "show the version and exit." },
   { "help",          'h',  0, 0,     "show this help and exit." },
   { 0, 0, 0, 0 }
 };
 
+// Shows the pages of a dictionary file in memory for --dictionary-info.
+// Every page touched by the lookups needs a TLB entry, so the number
+// of entries is estimated from the huge and the base pages.
+void write_page_stat(const char *data, size_t size, std::ostream *os) {
+  const size_t kHugePageSize = 2 * 1024 * 1024;
+  PageStat stat;
+  get_page_stat(data, size, &stat);
+  *os << "memory size:\t" << stat.size << std::endl;
+  *os << "page size:\t" << stat.page_size << std::endl;
+  *os << "pages:\t" << stat.pages << std::endl;
+  if (!stat.known) {
+    return;
+  }
+  *os << "resident pages:\t" << stat.resident << std::endl;
+  *os << "huge page size:\t" << stat.huge << std::endl;
+  *os << "tlb entries:\t"
+      << stat.huge / kHugePageSize + stat.pages - stat.huge / stat.page_size
+      << std::endl;
+}
+
+// Shows the file a part of the model is read from for
+// --dictionary-info: |name| in |dicdir|, or the section |name| of the
+// bundle if the dicdir is one.
+void write_filename(const Bundle *bundle, const std::string &dicdir,
+                    const char *name, std::ostream *os) {
+  if (bundle) {
+    *os << "filename:\t" << bundle->filename() << std::endl;
+    *os << "section:\t" << name << std::endl;
+  } else {
+    *os << "filename:\t" << create_filename(dicdir, name) << std::endl;
+  }
+}
+
+// load_dictionary_resource() followed by the dicrc of a dictionary
+// bundle, which is a section of the bundle given as the dicdir.
+bool load_model_resource(Param *param) {
+  if (!load_dictionary_resource(param)) {
+    return false;
+  }
+  const std::string dicdir = param->get<std::string>("dicdir");
+  if (!is_regular_file(dicdir.c_str())) {
+    return true;
+  }
+  Bundle bundle;
+  std::string dicrc;
+  if (!bundle.read(dicdir.c_str(), DICRC, &dicrc)) {
+    param->set_what(bundle.what());
+    return false;
+  }
+  std::istringstream is(dicrc);
+  return param->load(&is);
+}
+
+#ifdef HAVE_ATOMIC_OPS
+// One domain is shared by all models, since a lattice may be parsed
+// with the taggers of different models. It is never deleted, because
+// lattices may still be destroyed during the static destruction.
+epoch_domain *model_epoch_domain() {
+  static epoch_domain *domain = new epoch_domain;
+  return domain;
+}
+
+// Keeps the Viterbi read through ModelImpl::viterbi() alive until the
+// end of the scope. The lattice provides the reader record, as it is
+// used by one thread at a time.
+class scoped_model_reader {
+ public:
+  explicit scoped_model_reader(Lattice *lattice)
+      : reader_(model_epoch_domain(),
+                lattice->allocator()->epoch_record(model_epoch_domain())) {}
+ private:
+  scoped_epoch_reader reader_;
+};
+#endif
+
+// A bounded cache of the formatted results of TaggerImpl::parse(),
+// shared by the taggers of a model. The entries are spread over
+// kShardSize shards by the hash of the key, each with its own lock, so
+// that concurrent taggers rarely wait for each other. A shard evicts
+// its entries by the clock algorithm. An entry carries the generation
+// of the model it was made with, and is found only in that generation.
+class ResultCache {
+ public:
+  // sentences longer than this are not cached.
+  static const size_t kMaxSentenceSize = 1024;
+
+  bool find(const std::string &key, size_t generation,
+            std::string *result) {
+    const uint64_t hash = fingerprint(key);
+    Shard *shard = &shard_[hash % kShardSize];
+    scoped_lock l(&shard->lock);
+    std::map<uint64_t, size_t>::const_iterator it = shard->index.find(hash);
+    if (it != shard->index.end()) {
+      Entry *e = &shard->entry[it->second];
+      if (e->generation == generation && e->key == key) {
+        e->referenced = true;
+        result->assign(e->result);
+        ++shard->hits;
+        return true;
+      }
+    }
+    ++shard->misses;
+    return false;
+  }
+
+  void insert(const std::string &key, size_t generation,
+              const char *result) {
+    const uint64_t hash = fingerprint(key);
+    Shard *shard = &shard_[hash % kShardSize];
+    scoped_lock l(&shard->lock);
+    std::map<uint64_t, size_t>::iterator it = shard->index.find(hash);
+    size_t i = 0;
+    if (it != shard->index.end()) {
+      i = it->second;
+    } else if (shard->entry.size() < capacity_) {
+      i = shard->entry.size();
+      shard->entry.push_back(Entry());
+      shard->index[hash] = i;
+    } else {
+      while (shard->entry[shard->hand].referenced) {
+        shard->entry[shard->hand].referenced = false;
+        shard->hand = (shard->hand + 1) % shard->entry.size();
+      }
+      i = shard->hand;
+      shard->hand = (shard->hand + 1) % shard->entry.size();
+      shard->index.erase(shard->entry[i].hash);
+      shard->index[hash] = i;
+    }
+    Entry *e = &shard->entry[i];
+    e->key = key;
+    e->result = result;
+    e->hash = hash;
+    e->generation = generation;
+    e->referenced = false;
+  }
+
+  void clear() {
+    for (size_t i = 0; i < kShardSize; ++i) {
+      scoped_lock l(&shard_[i].lock);
+      shard_[i].entry.clear();
+      shard_[i].index.clear();
+      shard_[i].hand = 0;
+    }
+  }
+
+  void stat(size_t *hits, size_t *misses) const {
+    *hits = *misses = 0;
+    for (size_t i = 0; i < kShardSize; ++i) {
+      scoped_lock l(&shard_[i].lock);
+      *hits += shard_[i].hits;
+      *misses += shard_[i].misses;
+    }
+  }
+
+  explicit ResultCache(size_t capacity)
+      : shard_(new Shard[kShardSize]),
+        capacity_((capacity + kShardSize - 1) / kShardSize) {}
+
+ private:
+  static const size_t kShardSize = 16;
+
+  struct Entry {
+    std::string key;
+    std::string result;
+    uint64_t    hash;
+    size_t      generation;
+    bool        referenced;
+  };
+
+  struct Shard {
+    mutable mutex              lock;
+    std::vector<Entry>         entry;
+    std::map<uint64_t, size_t> index;
+    size_t                     hand;
+    size_t                     hits;
+    size_t                     misses;
+    Shard(): hand(0), hits(0), misses(0) {}
+  };
+
+  scoped_array<Shard> shard_;
+  size_t              capacity_;
+};
+
 class ModelImpl: public Model {
  public:
   ModelImpl();
@@ -120,6 +335,12 @@ class ModelImpl: public Model {
 
   Lattice *createLattice() const;
 
+  TaggerPool *createPool(size_t n, bool replicate) const;
+
+  // Opens the same model again, with the dictionaries read into
+  // memory allocated by the calling thread.
+  ModelImpl *replicate() const;
+
   const Viterbi *viterbi() const {
     return viterbi_;
   }
@@ -135,21 +356,35 @@ class ModelImpl: public Model {
     return writer_.get();
   }
 
-#ifdef HAVE_ATOMIC_OPS
-  read_write_mutex *mutex() const {
-    return &mutex_;
+  // NULL unless --result-cache is given.
+  ResultCache *result_cache() const {
+    return result_cache_.get();
+  }
+
+  // incremented by swap(). Read it before viterbi(), so that a result
+  // of the old Viterbi is never stored under the new generation.
+  size_t generation() const {
+    return generation_;
+  }
+
+  void result_cache_stat(size_t *hits, size_t *misses) const {
+    if (result_cache_.get()) {
+      result_cache_->stat(hits, misses);
+    } else {
+      *hits = *misses = 0;
+    }
   }
-#endif
 
  private:
   Viterbi            *viterbi_;
   scoped_ptr<Writer>  writer_;
   int                 request_type_;
   double              theta_;
-
-#ifdef HAVE_ATOMIC_OPS
-  mutable read_write_mutex      mutex_;
-#endif
+  Param               param_;
+  mutable mutex       param_mutex_;  // swap() against replicate()
+  scoped_ptr<ResultCache> result_cache_;
+  volatile size_t     generation_;
+  size_t              trim_size_;
 };
 
 class TaggerImpl: public Tagger {
@@ -166,6 +401,8 @@ class TaggerImpl: public Tagger {
   const char*           parse(const char*);
   const char*           parse(const char*, size_t);
   const char*           parse(const char*, size_t, char*, size_t);
+  bool                  parseBatch(const char **, const size_t *,
+                                   size_t, const char **);
   const Node*           parseToNode(const char*);
   const Node*           parseToNode(const char*, size_t = 0);
   const char*           parseNBest(size_t, const char*);
@@ -209,6 +446,21 @@ class TaggerImpl: public Tagger {
     mutable_lattice()->set_theta(theta_);
   }
 
+  // parses |str| and formats it into |out|, or into the lattice
+  // when |out| is NULL.
+  const char *parseString(const char *str, size_t len,
+                          char *out, size_t len2);
+
+  // the key of |str| in the result cache of the model. The output
+  // format is fixed for a model, so it need not be a part of the key.
+  void setResultKey(const char *str, size_t len) {
+    result_key_.assign(str, len);
+    result_key_.append(reinterpret_cast<const char *>(&request_type_),
+                       sizeof(request_type_));
+    result_key_.append(reinterpret_cast<const char *>(&theta_),
+                       sizeof(theta_));
+  }
+
   Lattice *mutable_lattice() {
     if (!lattice_.get()) {
       lattice_.reset(model()->createLattice());
@@ -216,11 +468,22 @@ class TaggerImpl: public Tagger {
     return lattice_.get();
   }
 
+  StringBuffer *batch_stream() {
+    if (!batch_ostrs_.get()) {
+      batch_ostrs_.reset(new StringBuffer);
+    }
+    return batch_ostrs_.get();
+  }
+
   const ModelImpl          *current_model_;
   scoped_ptr<ModelImpl>     model_;
   scoped_ptr<Lattice>       lattice_;
+  scoped_ptr<StringBuffer>  batch_ostrs_;
+  std::vector<size_t>       batch_offsets_;
   int                       request_type_;
   double                    theta_;
+  std::string               result_key_;
+  std::string               result_;
   std::string               what_;
 };
 
@@ -283,6 +546,12 @@ class LatticeImpl : public Lattice {
     return allocator_->newNode();
   }
 
+  // clear() releases the memory kept for the next sentence when the
+  // lattice keeps more than |size| bytes. 0 never releases it.
+  void set_trim_size(size_t size) { trim_size_ = size; }
+
+  void memory_stat(size_t *reserved, size_t *used) const;
+
   bool has_constraint() const;
   int boundary_constraint(size_t pos) const;
   const char *feature_constraint(size_t begin_pos) const;
@@ -323,6 +592,18 @@ class LatticeImpl : public Lattice {
   const Writer               *writer_;
   scoped_ptr<StringBuffer>    ostrs_;
   scoped_ptr<Allocator<Node, Path> > allocator_;
+  size_t                      trim_size_;
+
+  // bytes of the node lists and the output buffer.
+  size_t buffer_size() const {
+    return (end_nodes_.capacity() + begin_nodes_.capacity()) *
+        sizeof(Node *) +
+        feature_constraint_.capacity() * sizeof(const char *) +
+        boundary_constraint_.capacity() +
+        (ostrs_.get() ? ostrs_->capacity() : 0);
+  }
+
+  void trim();
 
   StringBuffer *stream() {
     if (!ostrs_.get()) {
@@ -336,9 +617,52 @@ class LatticeImpl : public Lattice {
   const char *enumNBestAsStringInternal(size_t N, StringBuffer *os);
 };
 
+// The slots are created by the threads which use them, so that the
+// tagger, the lattice and its allocator are first touched on the NUMA
+// node of that thread.
+class TaggerPoolImpl: public TaggerPool {
+ public:
+  size_t size() const { return slots_.size(); }
+
+  Tagger *tagger(size_t i) {
+    Slot *slot = get(i);
+    return slot ? slot->tagger : 0;
+  }
+
+  Lattice *lattice(size_t i) {
+    Slot *slot = get(i);
+    return slot ? slot->lattice : 0;
+  }
+
+  int node(size_t i) const {
+    return (i < slots_.size() && slots_[i]) ? slots_[i]->node : -1;
+  }
+
+  TaggerPoolImpl(const ModelImpl *model, size_t n, bool replicate)
+      : model_(model), replicate_(replicate), slots_(n, 0) {}
+  virtual ~TaggerPoolImpl();
+
+ private:
+  struct Slot {
+    Tagger  *tagger;
+    Lattice *lattice;
+    int      node;
+  };
+
+  Slot *get(size_t i);
+  const ModelImpl *replica(int node);
+
+  const ModelImpl          *model_;
+  bool                      replicate_;
+  std::vector<Slot *>       slots_;
+  std::vector<ModelImpl *>  replicas_;  // indexed by the NUMA node
+  mutex                     mutex_;
+};
+
 ModelImpl::ModelImpl()
     : viterbi_(new Viterbi), writer_(new Writer),
-      request_type_(MECAB_ONE_BEST), theta_(0.0) {}
+      request_type_(MECAB_ONE_BEST), theta_(0.0), generation_(0),
+      trim_size_(0) {}
 
 ModelImpl::~ModelImpl() {
   delete viterbi_;
@@ -348,7 +672,7 @@ ModelImpl::~ModelImpl() {
 bool ModelImpl::open(int argc, char **argv) {
   Param param;
   if (!param.open(argc, argv, long_options) ||
-      !load_dictionary_resource(&param)) {
+      !load_model_resource(&param)) {
     setGlobalError(param.what());
     return false;
   }
@@ -358,7 +682,7 @@ bool ModelImpl::open(int argc, char **argv) {
 bool ModelImpl::open(const char *arg) {
   Param param;
   if (!param.open(arg, long_options) ||
-      !load_dictionary_resource(&param)) {
+      !load_model_resource(&param)) {
     setGlobalError(param.what());
     return false;
   }
@@ -366,6 +690,7 @@ bool ModelImpl::open(const char *arg) {
 }
 
 bool ModelImpl::open(const Param &param) {
+  param_.copy(param);
   if (!writer_->open(param) || !viterbi_->open(param)) {
     std::string error = viterbi_->what();
     if (!error.empty()) {
@@ -376,9 +701,20 @@ bool ModelImpl::open(const Param &param) {
     return false;
   }
 
+  writer_->set_tokenizer(viterbi_->tokenizer());
   request_type_ = load_request_type(param);
+  if (writer_->needs_paths()) {
+    request_type_ &= ~MECAB_MARGINAL_WITHOUT_PATH;
+  }
   theta_ = param.get<double>("theta");
 
+  trim_size_ = param.get<size_t>("trim-memory") * 1024 * 1024;
+
+  const size_t result_cache_size = param.get<size_t>("result-cache");
+  if (result_cache_size > 0) {
+    result_cache_.reset(new ResultCache(result_cache_size));
+  }
+
   return is_available();
 }
 
@@ -404,13 +740,27 @@ bool ModelImpl::swap(Model *model) {
     return false;
   }
 
+  // Readers never block the swap. The old Viterbi is deleted once the
+  // readers that may have seen it have left. The taggers format their
+  // results before leaving, so a reader may write the nodes of the old
+  // Viterbi with the tokenizer of the new one; the writer then finds
+  // their features in none of its dictionaries and splits them as CSV.
+  // Nodes kept by the caller after parse() do not survive the swap.
   Viterbi *current_viterbi = viterbi_;
+  viterbi_      = m->take_viterbi();
+  writer_->set_tokenizer(viterbi_->tokenizer());
+  request_type_ = m->request_type();
+  theta_        = m->theta();
   {
-    scoped_writer_lock l(mutex());
-    viterbi_      = m->take_viterbi();
-    request_type_ = m->request_type();
-    theta_        = m->theta();
+    scoped_lock l(&param_mutex_);
+    param_.copy(m->param_);
   }
+  memory_barrier();
+  ++generation_;
+  if (result_cache_.get()) {
+    result_cache_->clear();
+  }
+  model_epoch_domain()->synchronize();
 
   delete current_viterbi;
 
@@ -439,7 +789,93 @@ Lattice *ModelImpl::createLattice() const {
     setGlobalError("Model is not available");
     return 0;
   }
-  return new LatticeImpl(writer_.get());
+  LatticeImpl *lattice = new LatticeImpl(writer_.get());
+  lattice->set_trim_size(trim_size_);
+  return lattice;
+}
+
+TaggerPool *ModelImpl::createPool(size_t n, bool replicate) const {
+  if (!is_available()) {
+    setGlobalError("Model is not available");
+    return 0;
+  }
+  return new TaggerPoolImpl(this, n, replicate);
+}
+
+ModelImpl *ModelImpl::replicate() const {
+  Param param;
+  {
+    scoped_lock l(&param_mutex_);
+    param.copy(param_);
+  }
+  param.set<bool>("load-dictionary", true);
+  ModelImpl *model = new ModelImpl;
+  if (!model->open(param)) {
+    delete model;
+    return 0;
+  }
+  return model;
+}
+
+TaggerPoolImpl::~TaggerPoolImpl() {
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    if (slots_[i]) {
+      delete slots_[i]->lattice;
+      delete slots_[i]->tagger;
+      delete slots_[i];
+    }
+  }
+  for (size_t i = 0; i < replicas_.size(); ++i) {
+    delete replicas_[i];
+  }
+}
+
+TaggerPoolImpl::Slot *TaggerPoolImpl::get(size_t i) {
+  if (i >= slots_.size()) {
+    setGlobalError("slot index is out of range");
+    return 0;
+  }
+  if (slots_[i]) {
+    return slots_[i];
+  }
+
+  const int node = current_numa_node();
+  const ModelImpl *model = replicate_ ? replica(node) : model_;
+  if (!model) {
+    return 0;
+  }
+
+  Tagger *tagger = model->createTagger();
+  Lattice *lattice = model->createLattice();
+  if (!tagger || !lattice) {
+    delete tagger;
+    delete lattice;
+    return 0;
+  }
+
+  // Parses an empty sentence so that this thread allocates the
+  // first chunk of the node freelist.
+  lattice->set_sentence("");
+  tagger->parse(lattice);
+  lattice->clear();
+
+  Slot *slot = new Slot;
+  slot->tagger = tagger;
+  slot->lattice = lattice;
+  slot->node = node;
+  slots_[i] = slot;
+  return slot;
+}
+
+const ModelImpl *TaggerPoolImpl::replica(int node) {
+  scoped_lock l(&mutex_);
+  if (static_cast<size_t>(node) >= replicas_.size()) {
+    replicas_.resize(node + 1, 0);
+  }
+  if (!replicas_[node]) {
+    replicas_[node] = model_->replicate();
+  }
+  return replicas_[node];
 }
 
 TaggerImpl::TaggerImpl()
@@ -552,7 +988,7 @@ bool TaggerImpl::all_morphs() const {
 
 bool TaggerImpl::parse(Lattice *lattice) const {
 #ifdef HAVE_ATOMIC_OPS
-  scoped_reader_lock l(model()->mutex());
+  scoped_model_reader l(lattice);
 #endif
 
   return model()->viterbi()->analyze(lattice);
@@ -563,14 +999,58 @@ const char *TaggerImpl::parse(const char *str) {
 }
 
 const char *TaggerImpl::parse(const char *str, size_t len) {
+  return parse(str, len, 0, 0);
+}
+
+const char *TaggerImpl::parse(const char *str, size_t len,
+                              char *out, size_t len2) {
+  ResultCache *cache = model()->result_cache();
+  if (!cache || len > ResultCache::kMaxSentenceSize) {
+    return parseString(str, len, out, len2);
+  }
+
+  const size_t generation = model()->generation();
+  setResultKey(str, len);
+  if (cache->find(result_key_, generation, &result_)) {
+    // No lattice is built for a cached result. It is cleared so that
+    // formatNode(), next() and nextNode() fail rather than show the
+    // previous sentence.
+    mutable_lattice()->clear();
+    if (!out) {
+      return result_.c_str();
+    }
+    if (result_.size() >= len2) {
+      set_what("output buffer overflow");
+      return 0;
+    }
+    std::memcpy(out, result_.c_str(), result_.size() + 1);
+    return out;
+  }
+
+  const char *result = parseString(str, len, out, len2);
+  if (result) {
+    cache->insert(result_key_, generation, result);
+  }
+  return result;
+}
+
+const char *TaggerImpl::parseString(const char *str, size_t len,
+                                    char *out, size_t len2) {
   Lattice *lattice = mutable_lattice();
   initRequestType();
   lattice->set_sentence(str, len);
-  if (!parse(lattice)) {
+  // The result is written in the same read-side section as the
+  // analysis, since the nodes refer to the dictionaries and the writer
+  // to the tokenizer of the Viterbi which swap() deletes.
+#ifdef HAVE_ATOMIC_OPS
+  scoped_model_reader l(lattice);
+#endif
+  if (!model()->viterbi()->analyze(lattice)) {
     set_what(lattice->what());
     return 0;
   }
-  const char *result = lattice->toString();
+  const char *result = out ?
+      lattice->toString(out, len2) : lattice->toString();
   if (!result) {
     set_what(lattice->what());
     return 0;
@@ -578,21 +1058,47 @@ const char *TaggerImpl::parse(const char *str, size_t len) {
   return result;
 }
 
-const char *TaggerImpl::parse(const char *str, size_t len,
-                              char *out, size_t len2) {
+bool TaggerImpl::parseBatch(const char **str, const size_t *len,
+                            size_t n, const char **results) {
   Lattice *lattice = mutable_lattice();
+  StringBuffer *os = batch_stream();
+  os->clear();
+  batch_offsets_.resize(n);
   initRequestType();
-  lattice->set_sentence(str, len);
-  if (!parse(lattice)) {
-    set_what(lattice->what());
-    return 0;
+
+  {
+#ifdef HAVE_ATOMIC_OPS
+    scoped_model_reader l(lattice);
+#endif
+    const Viterbi *viterbi = model()->viterbi();
+    const Writer  *writer  = model()->writer();
+    for (size_t i = 0; i < n; ++i) {
+      lattice->set_sentence(str[i], len[i]);
+      if (!viterbi->analyze(lattice)) {
+        set_what(lattice->what());
+        return false;
+      }
+      batch_offsets_[i] = os->size();
+      if (!writer->write(lattice, os)) {
+        set_what(lattice->what());
+        return false;
+      }
+      *os << '\0';
+    }
   }
-  const char *result = lattice->toString(out, len2);
-  if (!result) {
-    set_what(lattice->what());
-    return 0;
+
+  // |os| may be reallocated while writing, so the result pointers
+  // are fixed only after all the sentences are written.
+  const char *buf = os->str();
+  if (!buf) {
+    set_what("output buffer overflow");
+    return false;
   }
-  return result;
+  for (size_t i = 0; i < n; ++i) {
+    results[i] = buf + batch_offsets_[i];
+  }
+
+  return true;
 }
 
 const Node *TaggerImpl::parseToNode(const char *str) {
@@ -674,7 +1180,10 @@ const char* TaggerImpl::parseNBest(size_t N,
   lattice->add_request_type(MECAB_NBEST);
   lattice->set_sentence(str, len);
 
-  if (!parse(lattice)) {
+#ifdef HAVE_ATOMIC_OPS
+  scoped_model_reader l(lattice);  // see parseString()
+#endif
+  if (!model()->viterbi()->analyze(lattice)) {
     set_what(lattice->what());
     return 0;
   }
@@ -694,7 +1203,10 @@ const char* TaggerImpl::parseNBest(size_t N, const char* str, size_t len,
   lattice->add_request_type(MECAB_NBEST);
   lattice->set_sentence(str, len);
 
-  if (!parse(lattice)) {
+#ifdef HAVE_ATOMIC_OPS
+  scoped_model_reader l(lattice);  // see parseString()
+#endif
+  if (!model()->viterbi()->analyze(lattice)) {
     set_what(lattice->what());
     return 0;
   }
@@ -735,7 +1247,8 @@ LatticeImpl::LatticeImpl(const Writer *writer)
       request_type_(MECAB_ONE_BEST),
       writer_(writer),
       ostrs_(0),
-      allocator_(new Allocator<Node, Path>) {
+      allocator_(new Allocator<Node, Path>),
+      trim_size_(0) {
   begin_nodes_.reserve(MIN_INPUT_BUFFER_SIZE);
   end_nodes_.reserve(MIN_INPUT_BUFFER_SIZE);
 }
@@ -755,6 +1268,30 @@ void LatticeImpl::clear() {
   theta_ = kDefaultTheta;
   Z_ = 0.0;
   sentence_ = 0;
+  if (trim_size_ &&
+      allocator_->reserved_size() + buffer_size() > trim_size_) {
+    trim();
+  }
+}
+
+void LatticeImpl::trim() {
+  allocator_->trim();
+  ostrs_.reset(0);
+  std::vector<Node *>().swap(end_nodes_);
+  std::vector<Node *>().swap(begin_nodes_);
+  std::vector<const char *>().swap(feature_constraint_);
+  std::vector<unsigned char>().swap(boundary_constraint_);
+  begin_nodes_.reserve(MIN_INPUT_BUFFER_SIZE);
+  end_nodes_.reserve(MIN_INPUT_BUFFER_SIZE);
+}
+
+void LatticeImpl::memory_stat(size_t *reserved, size_t *used) const {
+  *reserved = allocator_->reserved_size() + buffer_size();
+  *used = allocator_->used_size() +
+      (end_nodes_.size() + begin_nodes_.size()) * sizeof(Node *) +
+      feature_constraint_.size() * sizeof(const char *) +
+      boundary_constraint_.size() +
+      (ostrs_.get() ? ostrs_->size() : 0);
 }
 
 void LatticeImpl::set_sentence(const char *sentence) {
@@ -787,6 +1324,11 @@ bool LatticeImpl::next() {
     return false;
   }
 
+  if (!is_available()) {
+    set_what("Lattice is not available");
+    return false;
+  }
+
   if (!allocator()->nbest_generator()->next()) {
     return false;
   }
@@ -918,6 +1460,10 @@ const char *LatticeImpl::toStringInternal(const Node *node,
     set_what("node is NULL");
     return 0;
   }
+  if (!is_available()) {
+    set_what("Lattice is not available");
+    return 0;
+  }
   if (writer_) {
     if (!writer_->writeNode(this, node, os)) {
       return 0;
@@ -1130,6 +1676,526 @@ void deleteLattice(Lattice *lattice) {
 }
 }  // MeCab
 
+namespace MeCab {
+namespace {
+
+// Sentences per worker thread in one chunk of the parallel pipeline.
+const size_t kThreadChunkSize = 256;
+
+// Reads one sentence (a line, or a block terminated by "EOS" or an
+// empty line in partial mode) into |ibuf|.
+// Returns false when the input is exhausted.
+bool read_sentence(std::istream *is, char *ibuf, size_t ibufsize,
+                   bool partial) {
+  if (!partial) {
+    is->getline(ibuf, ibufsize);
+  } else {
+    std::string sentence;
+    scoped_fixed_array<char, BUF_SIZE> line;
+    for (;;) {
+      if (!is->getline(line.get(), line.size())) {
+        is->clear(std::ios::eofbit|std::ios::badbit);
+        break;
+      }
+      sentence += line.get();
+      sentence += '\n';
+      if (std::strcmp(line.get(), "EOS") == 0 || line[0] == '\0') {
+        break;
+      }
+    }
+    std::strncpy(ibuf, sentence.c_str(), ibufsize);
+  }
+  if (is->eof() && !ibuf[0]) {
+    return false;
+  }
+  if (is->fail()) {
+    std::cerr << "input-buffer overflow. "
+              << "The line is split. use -b #SIZE option." << std::endl;
+    is->clear();
+  }
+  return true;
+}
+
+// A sentence as a (pointer, length) pair.
+typedef std::pair<const char *, size_t> Span;
+
+// A block of consecutive input sentences and their parsed results.
+// |spans| point either to |sentences| or into a mapped input file.
+// The strings are recycled between chunks to keep their capacity.
+struct SentenceChunk {
+  std::vector<std::string> sentences;
+  std::vector<Span>        spans;
+  std::vector<std::string> results;
+  size_t                   size;
+  size_t                   failed;   // index of the first failure
+  std::string              what;
+  bool                     eof;
+  SentenceChunk(): size(0), failed(0), eof(false) {}
+};
+
+// Returns the next line of [*begin, end) and advances |*begin| past it.
+// Returns false at the end.
+bool next_line(const char **begin, const char *end, Span *line) {
+  if (*begin >= end) {
+    return false;
+  }
+  const char *eol = static_cast<const char *>(
+      std::memchr(*begin, '\n', end - *begin));
+  if (!eol) {
+    eol = end;
+  }
+  *line = Span(*begin, eol - *begin);
+  *begin = std::min(eol + 1, end);
+  return true;
+}
+
+void clear_chunk(size_t max_size, SentenceChunk *chunk) {
+  if (chunk->spans.size() < max_size) {
+    chunk->spans.resize(max_size);
+    chunk->results.resize(max_size);
+  }
+  chunk->size = 0;
+  chunk->failed = max_size;
+  chunk->what.clear();
+  chunk->eof = false;
+}
+
+// Reads the sentences of a chunk from a stream.
+struct StreamReader {
+  std::istream *is;
+  char         *ibuf;
+  size_t        ibufsize;
+  bool          partial;
+
+  // Fills |chunk| with at most |max_size| sentences.
+  void read(size_t max_size, SentenceChunk *chunk) {
+    clear_chunk(max_size, chunk);
+    if (chunk->sentences.size() < max_size) {
+      chunk->sentences.resize(max_size);
+    }
+    while (chunk->size < max_size) {
+      if (!read_sentence(is, ibuf, ibufsize, partial)) {
+        chunk->eof = true;
+        break;
+      }
+      std::string &sentence = chunk->sentences[chunk->size];
+      sentence.assign(ibuf);
+      chunk->spans[chunk->size++] = Span(sentence.data(), sentence.size());
+    }
+  }
+};
+
+// Reads the lines of a mapped file [begin, end) without copying them.
+struct MappedReader {
+  const char *begin;
+  const char *end;
+
+  void read(size_t max_size, SentenceChunk *chunk) {
+    clear_chunk(max_size, chunk);
+    while (chunk->size < max_size) {
+      if (!next_line(&begin, end, &chunk->spans[chunk->size])) {
+        chunk->eof = true;
+        break;
+      }
+      ++chunk->size;
+    }
+  }
+};
+
+// Writes the results of |chunk| in input order, stopping at the
+// first sentence which could not be parsed.
+bool write_chunk(const SentenceChunk &chunk, std::ostream *os) {
+  const size_t size = std::min(chunk.size, chunk.failed);
+  for (size_t i = 0; i < size; ++i) {
+    *os << chunk.results[i];
+  }
+  *os << std::flush;
+  return chunk.failed >= chunk.size;
+}
+
+// Parses the sentences [begin, end) of a chunk with its own tagger.
+class ParserThread : public thread {
+ public:
+  void run() {
+    failed_ = chunk_->size;
+    what_.clear();
+    for (size_t i = begin_; i < end_; ++i) {
+      const Span &sentence = chunk_->spans[i];
+      const char *r = (nbest_ >= 2) ?
+          tagger_->parseNBest(nbest_, sentence.first, sentence.second) :
+          tagger_->parse(sentence.first, sentence.second);
+      if (!r) {
+        failed_ = i;
+        what_ = tagger_->what();
+        return;
+      }
+      chunk_->results[i].assign(r);
+    }
+  }
+
+  void set(SentenceChunk *chunk, size_t begin, size_t end) {
+    chunk_ = chunk;
+    begin_ = begin;
+    end_ = end;
+  }
+
+  size_t failed() const { return failed_; }
+  const char *what() const { return what_.c_str(); }
+
+  ParserThread(Tagger *tagger, int nbest)
+      : tagger_(tagger), nbest_(nbest), chunk_(0),
+        begin_(0), end_(0), failed_(0) {}
+
+ private:
+  Tagger        *tagger_;
+  int            nbest_;
+  SentenceChunk *chunk_;
+  size_t         begin_;
+  size_t         end_;
+  size_t         failed_;
+  std::string    what_;
+};
+
+// Order-preserving parallel pipeline. While the workers parse the
+// current chunk, the previous chunk is written out and the next one is
+// read in, so reading and writing overlap with parsing.
+class ParallelParser {
+ public:
+  bool open(const ModelImpl &model, size_t nthreads, int nbest) {
+    for (size_t i = 0; i < nthreads; ++i) {
+      Tagger *tagger = model.createTagger();
+      if (!tagger) {
+        return false;
+      }
+      taggers_.push_back(tagger);
+      threads_.push_back(new ParserThread(tagger, nbest));
+    }
+    return true;
+  }
+
+  // Parses |is| until the end of input and writes the results to |os|.
+  // Returns false and sets |what| if some sentence could not be parsed.
+  bool parse(std::istream *is, char *ibuf, size_t ibufsize,
+             bool partial, std::ostream *os, std::string *what) {
+    StreamReader reader = { is, ibuf, ibufsize, partial };
+    return run(&reader, os, what);
+  }
+
+  // Parses the lines of [begin, end).
+  bool parse(const char *begin, const char *end,
+             std::ostream *os, std::string *what) {
+    MappedReader reader = { begin, end };
+    return run(&reader, os, what);
+  }
+
+  ~ParallelParser() {
+    for (size_t i = 0; i < threads_.size(); ++i) {
+      delete threads_[i];
+    }
+    for (size_t i = 0; i < taggers_.size(); ++i) {
+      delete taggers_[i];
+    }
+  }
+
+ private:
+  template <class Reader>
+  bool run(Reader *reader, std::ostream *os, std::string *what) {
+    const size_t max_size = kThreadChunkSize * threads_.size();
+    SentenceChunk *cur = &chunks_[0];
+    SentenceChunk *prev = &chunks_[1];
+    prev->size = 0;
+    prev->failed = 0;
+    reader->read(max_size, cur);
+
+    for (;;) {
+      start(cur);
+      const bool written = write_chunk(*prev, os);
+      if (written && !cur->eof) {
+        reader->read(max_size, prev);
+      }
+      join(cur);
+      if (!written) {
+        *what = prev->what;
+        return false;
+      }
+      if (cur->eof) {
+        if (!write_chunk(*cur, os)) {
+          *what = cur->what;
+          return false;
+        }
+        return true;
+      }
+      std::swap(cur, prev);
+    }
+
+    return true;
+  }
+
+  void start(SentenceChunk *chunk) {
+    const size_t n = threads_.size();
+    const size_t slice = (chunk->size + n - 1) / n;
+    for (size_t i = 0; i < n; ++i) {
+      const size_t begin = std::min(chunk->size, i * slice);
+      const size_t end = std::min(chunk->size, begin + slice);
+      threads_[i]->set(chunk, begin, end);
+      threads_[i]->start();
+    }
+  }
+
+  void join(SentenceChunk *chunk) {
+    for (size_t i = 0; i < threads_.size(); ++i) {
+      threads_[i]->join();
+    }
+    chunk->failed = chunk->size;
+    for (size_t i = 0; i < threads_.size(); ++i) {
+      if (threads_[i]->failed() < chunk->failed) {
+        chunk->failed = threads_[i]->failed();
+        chunk->what = threads_[i]->what();
+      }
+    }
+  }
+
+  std::vector<Tagger *>       taggers_;
+  std::vector<ParserThread *> threads_;
+  SentenceChunk               chunks_[2];
+};
+
+// Parses every sentence with and without MECAB_BEAM, and counts the
+// sentences whose 1-best results differ.
+class BeamReport {
+ public:
+  bool open(const ModelImpl &model) {
+    beam_.reset(model.createLattice());
+    exact_.reset(model.createLattice());
+    if (!beam_.get() || !exact_.get()) {
+      return false;
+    }
+    beam_->set_request_type(model.request_type());
+    beam_->set_theta(model.theta());
+    exact_->set_request_type(model.request_type() & ~MECAB_BEAM);
+    exact_->set_theta(model.theta());
+    return true;
+  }
+
+  // Returns the result of the beam search.
+  const char *parse(Tagger *tagger, const char *sentence) {
+    beam_->set_sentence(sentence);
+    exact_->set_sentence(sentence);
+    if (!tagger->parse(beam_.get()) || !tagger->parse(exact_.get())) {
+      what_ = tagger->what();
+      return 0;
+    }
+    ++sentences_;
+    if (!is_same_path(beam_->bos_node(), exact_->bos_node())) {
+      ++changed_;
+    }
+    const char *result = beam_->toString();
+    if (!result) {
+      what_ = beam_->what();
+    }
+    return result;
+  }
+
+  void print(std::ostream *os) const {
+    *os << "beam: " << changed_ << " of " << sentences_
+        << " sentences changed the 1-best result ("
+        << (sentences_ ? 100.0 * changed_ / sentences_ : 0.0)
+        << "%)" << std::endl;
+  }
+
+  const char *what() const { return what_.c_str(); }
+
+  BeamReport(): sentences_(0), changed_(0) {}
+
+ private:
+  static bool is_same_path(const Node *x, const Node *y) {
+    for (; x && y; x = x->next, y = y->next) {
+      if (x->length != y->length || x->rlength != y->rlength ||
+          x->stat != y->stat || x->lcAttr != y->lcAttr ||
+          x->rcAttr != y->rcAttr ||
+          std::strcmp(x->feature, y->feature) != 0) {
+        return false;
+      }
+    }
+    return !x && !y;
+  }
+
+  scoped_ptr<Lattice> beam_;
+  scoped_ptr<Lattice> exact_;
+  size_t              sentences_;
+  size_t              changed_;
+  std::string         what_;
+};
+
+// Analyzes each input line incrementally in a window of bounded size,
+// so that lines of any length are neither split nor held in memory.
+//
+// When the window is full, its lattice is analyzed and the morphemes
+// on which the best paths to all the nodes crossing the position
+// window - margin agree are written out. Those do not change whatever
+// text follows, as long as no word (with its preceding spaces) is
+// longer than the margin. The rest of the window is analyzed again
+// with more input, taking over the right context id of the last
+// written morpheme. If the paths do not agree anywhere, the best path
+// is cut at that position, which may differ from the analysis of the
+// whole line.
+class StreamParser {
+ public:
+  bool open(const ModelImpl &model, size_t window) {
+    model_ = &model;
+    window_ = window;
+    margin_ = window / 4;
+    buf_.reset(new char[window + 1]);
+    lattice_.reset(model.createLattice());
+    if (!lattice_.get()) {
+      return false;
+    }
+    lattice_->set_request_type(model.request_type());
+    return true;
+  }
+
+  // Parses |is| until the end of input and writes the results to |os|.
+  bool parse(std::istream *is, std::ostream *os, std::string *what) {
+    std::string text;
+    bool eof = false;
+    while (!eof) {
+      const bool eol = fill(is, &text, &eof);
+      if (eof && text.empty() && !context_) {
+        break;
+      }
+      if (!analyze(&text, eol || eof, what)) {
+        return false;
+      }
+      if (!output_.str()) {
+        *what = "output buffer overflow";
+        return false;
+      }
+      os->write(output_.str(), output_.size());
+      *os << std::flush;
+      output_.clear();
+    }
+    return true;
+  }
+
+  StreamParser(): model_(0), window_(0), margin_(0), context_(false) {}
+
+ private:
+  // Appends the input to |text| until the end of line or until |text|
+  // fills the window. Returns true at the end of line.
+  bool fill(std::istream *is, std::string *text, bool *eof) {
+    while (text->size() < window_) {
+      is->getline(buf_.get(), window_ - text->size() + 1);
+      const size_t size = std::strlen(buf_.get());
+      text->append(buf_.get(), size);
+      if (is->eof()) {
+        *eof = true;
+        return false;
+      }
+      if (!is->fail()) {
+        return true;
+      }
+      is->clear();
+    }
+    return false;
+  }
+
+  // Analyzes |text|, writes the fixed morphemes to |output_| and
+  // removes their text. All of |text| is written at the end of line.
+  bool analyze(std::string *text, bool eol, std::string *what) {
+    lattice_->set_sentence(text->c_str(), text->size());
+#ifdef HAVE_ATOMIC_OPS
+    // until the nodes are written, as in TaggerImpl::parseString().
+    scoped_model_reader l(lattice_.get());
+#endif
+    if (!model_->viterbi()->analyze(lattice_.get(),
+                                    context_ ? &last_node_ : 0)) {
+      *what = lattice_->what();
+      return false;
+    }
+
+    const Writer *writer = model_->writer();
+    if (!context_ && !writer->writeBOS(lattice_.get(), &output_)) {
+      *what = "cannot write the result";
+      return false;
+    }
+
+    const Node *bos = lattice_->bos_node();
+    if (eol) {
+      if (!writer->writeNodes(lattice_.get(), bos->next,
+                              lattice_->eos_node(), &output_) ||
+          !writer->writeEOS(lattice_.get(), lattice_->eos_node(),
+                            &output_)) {
+        *what = "cannot write the result";
+        return false;
+      }
+      context_ = false;
+      text->clear();
+      return true;
+    }
+
+    const Node *last = fixed_node();
+    if (!writer->writeNodes(lattice_.get(), bos->next, last->next,
+                            &output_)) {
+      *what = "cannot write the result";
+      return false;
+    }
+    last_node_ = *last;
+    context_ = true;
+    text->erase(0, last->surface - lattice_->sentence() + last->length);
+    return true;
+  }
+
+  // Returns the last node of the best path which is shared by the best
+  // paths to all the nodes over the position window - margin.
+  const Node *fixed_node() const {
+    const size_t cut = lattice_->size() - margin_;
+    const Node *bos = lattice_->bos_node();
+    const Node *result = 0;
+    size_t result_pos = cut;
+    for (size_t pos = 0; pos <= cut; ++pos) {
+      for (const Node *node = lattice_->begin_nodes(pos);
+           node; node = node->bnext) {
+        if (pos + node->rlength < cut) {
+          continue;
+        }
+        const Node *shared = node;
+        while (shared->prev && !shared->isbest) {
+          shared = shared->prev;
+        }
+        const size_t shared_pos = end_pos(shared);
+        if (!result || shared_pos < result_pos) {
+          result = shared;
+          result_pos = shared_pos;
+        }
+      }
+    }
+
+    if (!result || result == bos) {
+      // the paths do not agree; cut the best path at |cut|.
+      result = bos->next;
+      while (result->next->next && end_pos(result->next) <= cut) {
+        result = result->next;
+      }
+    }
+    return result;
+  }
+
+  size_t end_pos(const Node *node) const {
+    return node->surface + node->length - lattice_->sentence();
+  }
+
+  const ModelImpl    *model_;
+  size_t              window_;
+  size_t              margin_;
+  scoped_array<char>  buf_;
+  scoped_ptr<Lattice> lattice_;
+  StringBuffer        output_;
+  Node                last_node_;
+  bool                context_;
+};
+}  // namespace
+}  // MeCab
+
 int mecab_do(int argc, char **argv) {
 #define WHAT_ERROR(msg) do {                    \
     std::cout << msg << std::endl;              \
@@ -1152,7 +2218,7 @@ int mecab_do(int argc, char **argv) {
     return EXIT_SUCCESS;
   }
 
-  if (!load_dictionary_resource(&param)) {
+  if (!MeCab::load_model_resource(&param)) {
     std::cout << param.what() << std::endl;
     return EXIT_SUCCESS;
   }
@@ -1189,15 +2255,48 @@ int mecab_do(int argc, char **argv) {
   }
 
   if (param.get<bool>("dictionary-info")) {
+    const MeCab::Tokenizer<MeCab::Node, MeCab::Path> *tokenizer =
+        model->viterbi()->tokenizer();
+    const MeCab::Bundle *bundle = model->viterbi()->bundle();
+    size_t i = 0;
     for (const MeCab::DictionaryInfo *d = model->dictionary_info();
-         d; d = d->next) {
+         d; d = d->next, ++i) {
+      const MeCab::Dictionary *dic = tokenizer->dictionary(i);
       *ofs << "filename:\t" << d->filename << std::endl;
+      if (*dic->section()) {
+        *ofs << "section:\t" << dic->section() << std::endl;
+      }
       *ofs << "version:\t" << d->version << std::endl;
       *ofs << "charset:\t" << d->charset << std::endl;
       *ofs << "type:\t" << d->type   << std::endl;
       *ofs << "size:\t" << d->size << std::endl;
       *ofs << "left size:\t" << d->lsize << std::endl;
       *ofs << "right size:\t" << d->rsize << std::endl;
+      MeCab::write_page_stat(dic->data(), dic->data_size(), &*ofs);
+      *ofs << std::endl;
+    }
+
+    const std::string dicdir = param.get<std::string>("dicdir");
+    const MeCab::Dictionary *unkdic = tokenizer->unknown_dictionary();
+    MeCab::write_filename(bundle, dicdir, UNK_DIC_FILE, &*ofs);
+    MeCab::write_page_stat(unkdic->data(), unkdic->data_size(), &*ofs);
+    *ofs << std::endl;
+
+    const MeCab::CharProperty *property = tokenizer->char_property();
+    MeCab::write_filename(bundle, dicdir, CHAR_PROPERTY_FILE, &*ofs);
+    MeCab::write_page_stat(property->data(), property->data_size(), &*ofs);
+    *ofs << std::endl;
+
+    const MeCab::Connector *connector = model->viterbi()->connector();
+    MeCab::write_filename(bundle, dicdir, MATRIX_FILE, &*ofs);
+    MeCab::write_page_stat(connector->data(), connector->data_size(), &*ofs);
+    *ofs << std::endl;
+
+    if (bundle) {
+      const char *broken = bundle->verify();
+      *ofs << "bundle:\t" << bundle->filename() << std::endl;
+      *ofs << "checksum:\t" << (broken ? "broken " : "ok")
+           << (broken ? broken : "") << std::endl;
       *ofs << std::endl;
     }
     return EXIT_FAILURE;
@@ -1223,44 +2322,135 @@ int mecab_do(int argc, char **argv) {
   MeCab::scoped_array<char> ibuf_data(new char[ibufsize]);
   char *ibuf = ibuf_data.get();
 
+  int nthreads = param.get<int>("threads");
+  if (nthreads <= 0) {
+    WHAT_ERROR("invalid number of threads");
+  }
+#ifndef MECAB_USE_THREAD
+  if (nthreads >= 2) {
+    std::cerr << "multi-threading is not supported. "
+              << "use a single thread." << std::endl;
+    nthreads = 1;
+  }
+#endif
+
   MeCab::scoped_ptr<MeCab::Tagger> tagger(model->createTagger());
 
   if (!tagger.get()) {
     WHAT_ERROR("cannot create tagger");
   }
 
+  MeCab::scoped_ptr<MeCab::BeamReport> beam_report;
+  if (param.get<bool>("beam-report")) {
+    if (!(model->request_type() & MECAB_BEAM) || nbest >= 2 ||
+        (model->request_type() & MECAB_MARGINAL_PROB)) {
+      WHAT_ERROR("--beam-report needs --beam in the 1-best mode");
+    }
+    if (nthreads >= 2) {
+      std::cerr << "--beam-report uses a single thread." << std::endl;
+      nthreads = 1;
+    }
+    beam_report.reset(new MeCab::BeamReport);
+    if (!beam_report->open(*model)) {
+      WHAT_ERROR("cannot create lattice");
+    }
+  }
+
+  MeCab::scoped_ptr<MeCab::StreamParser> stream_parser;
+  if (param.get<bool>("stream")) {
+    if ((model->request_type() &
+         ~(MECAB_BEAM | MECAB_ALLOCATE_SENTENCE)) != MECAB_ONE_BEST) {
+      WHAT_ERROR("--stream is only available in the 1-best mode");
+    }
+    if (!model->writer()->is_streamable()) {
+      WHAT_ERROR("--stream does not support this output format");
+    }
+    if (beam_report.get()) {
+      WHAT_ERROR("--stream cannot be used with --beam-report");
+    }
+    if (nthreads >= 2) {
+      std::cerr << "--stream uses a single thread." << std::endl;
+      nthreads = 1;
+    }
+    stream_parser.reset(new MeCab::StreamParser);
+    if (!stream_parser->open(*model, ibufsize)) {
+      WHAT_ERROR("cannot create lattice");
+    }
+  }
+
+  MeCab::scoped_ptr<MeCab::ParallelParser> parallel_parser;
+  if (nthreads >= 2) {
+    parallel_parser.reset(new MeCab::ParallelParser);
+    if (!parallel_parser->open(*model, nthreads, nbest)) {
+      WHAT_ERROR("cannot create tagger");
+    }
+  }
+
   for (size_t i = 0; i < rest.size(); ++i) {
     MeCab::istream_wrapper ifs(rest[i].c_str());
     if (!*ifs) {
       WHAT_ERROR("no such file or directory: " << rest[i]);
     }
 
-    while (true) {
-      if (!partial) {
-        ifs->getline(ibuf, ibufsize);
-      } else {
-        std::string sentence;
-        MeCab::scoped_fixed_array<char, BUF_SIZE> line;
-        for (;;) {
-          if (!ifs->getline(line.get(), line.size())) {
-            ifs->clear(std::ios::eofbit|std::ios::badbit);
-            break;
-          }
-          sentence += line.get();
-          sentence += '\n';
-          if (std::strcmp(line.get(), "EOS") == 0 || line[0] == '\0') {
-            break;
-          }
+    if (stream_parser.get()) {
+      std::string what;
+      if (!stream_parser->parse(&*ifs, &*ofs, &what)) {
+        WHAT_ERROR(what);
+      }
+      return false;
+    }
+
+    // Regular files are mapped, and their lines are parsed in place
+    // without the input buffer size limit.
+    MeCab::Mmap<char> mmap;
+    if (!partial && !beam_report.get() &&
+        MeCab::is_regular_file(rest[i].c_str()) &&
+        mmap.open(rest[i].c_str())) {
+      const char *begin = mmap.begin();
+      const char *end = mmap.end();
+      if (parallel_parser.get()) {
+        std::string what;
+        if (!parallel_parser->parse(begin, end, &*ofs, &what)) {
+          WHAT_ERROR(what);
         }
-        std::strncpy(ibuf, sentence.c_str(), ibufsize);
+        return false;
+      }
+      MeCab::Span line;
+      while (MeCab::next_line(&begin, end, &line)) {
+        const char *r = (nbest >= 2) ?
+            tagger->parseNBest(nbest, line.first, line.second) :
+            tagger->parse(line.first, line.second);
+        if (!r)  {
+          WHAT_ERROR(tagger->what());
+        }
+        *ofs << r << std::flush;
+      }
+      return false;
+    }
+
+    if (parallel_parser.get()) {
+      std::string what;
+      if (!parallel_parser->parse(&*ifs, ibuf, ibufsize, partial,
+                                  &*ofs, &what)) {
+        WHAT_ERROR(what);
       }
-      if (ifs->eof() && !ibuf[0]) {
+      return false;
+    }
+
+    while (true) {
+      if (!MeCab::read_sentence(&*ifs, ibuf, ibufsize, partial)) {
+        if (beam_report.get()) {
+          beam_report->print(&std::cerr);
+        }
         return false;
       }
-      if (ifs->fail()) {
-        std::cerr << "input-buffer overflow. "
-                  << "The line is split. use -b #SIZE option." << std::endl;
-        ifs->clear();
+      if (beam_report.get()) {
+        const char *r = beam_report->parse(tagger.get(), ibuf);
+        if (!r) {
+          WHAT_ERROR(beam_report->what());
+        }
+        *ofs << r << std::flush;
+        continue;
       }
       const char *r = (nbest >= 2) ? tagger->parseNBest(nbest, ibuf) :
           tagger->parse(ibuf);
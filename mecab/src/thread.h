@@ -48,6 +48,7 @@ namespace MeCab {
 #define atomic_add(a, b) ::InterlockedExchangeAdd(a, b)
 #define compare_and_swap(a, b, c)  ::InterlockedCompareExchange(a, c, b)
 #define yield_processor() YieldProcessor()
+#define memory_barrier() MemoryBarrier()
 #define HAVE_ATOMIC_OPS 1
 #endif
 
@@ -58,6 +59,7 @@ namespace MeCab {
 #define atomic_add(a, b) __sync_add_and_fetch(a, b)
 #define compare_and_swap(a, b, c)  __sync_val_compare_and_swap(a, b, c)
 #define yield_processor() sched_yield()
+#define memory_barrier() __sync_synchronize()
 #define HAVE_ATOMIC_OPS 1
 #endif
 
@@ -68,77 +70,185 @@ namespace MeCab {
 #define atomic_add(a, b) OSAtomicAdd32(b, a)
 #define compare_and_swap(a, b, c) OSAtomicCompareAndSwapInt(b, c, a)
 #define yield_processor() sched_yield()
+#define memory_barrier() OSMemoryBarrier()
 #define HAVE_ATOMIC_OPS 1
 #endif
 
 #ifdef HAVE_ATOMIC_OPS
-// This is a simple non-scalable writer-preference lock.
-// Slightly modified the following paper.
-// "Scalable Reader-Writer Synchronization for Shared-Memory Multiprocessors"
-// PPoPP '91. John M. Mellor-Crummey and Michael L. Scott. T
-class read_write_mutex {
+// Epoch-based reclamation of data shared by the readers.
+//
+// Each reader owns a record and publishes the epoch it entered in it,
+// so the read side writes only to its own cache line and never waits.
+// A writer replaces the shared pointer, advances the epoch and calls
+// synchronize(), which waits until every reader that may still see
+// the old data has left. The old data can then be deleted.
+//
+// A record must not be used by two threads at the same time. Records
+// are recycled by acquire() and freed with the domain.
+class epoch_domain {
  public:
-  inline void write_lock() {
-    atomic_add(&write_pending_, 1);
-    while (compare_and_swap(&l_, 0, kWaFlag)) {
-      yield_processor();
-    }
-  }
-  inline void read_lock() {
-    while (write_pending_ > 0) {
-      yield_processor();
+  struct record {
+    char  head_pad[64];
+#ifdef HAVE_OSX_ATOMIC_OPS
+    volatile int epoch;   // 0 outside the read-side section
+    volatile int in_use;
+#else
+    volatile long epoch;  // 0 outside the read-side section
+    volatile long in_use;
+#endif
+    record *next;
+    char  tail_pad[64];
+  };
+
+  record *acquire() {
+    for (record *r = head_; r; r = r->next) {
+      if (r->in_use == 0 && compare_and_swap(&r->in_use, 0, 1) == 0) {
+        return r;
+      }
     }
-    atomic_add(&l_, kRcIncr);
-    while ((l_ & kWaFlag) != 0) {
+    record *r = new record;
+    r->epoch = 0;
+    r->in_use = 1;
+    while (compare_and_swap(&lock_, 0, 1)) {
       yield_processor();
     }
+    r->next = head_;
+    memory_barrier();
+    head_ = r;
+    atomic_add(&lock_, -1);
+    return r;
   }
-  inline void write_unlock() {
-    atomic_add(&l_, -kWaFlag);
-    atomic_add(&write_pending_, -1);
+
+  void release(record *r) {
+    r->epoch = 0;
+    memory_barrier();
+    r->in_use = 0;
   }
-  inline void read_unlock() {
-    atomic_add(&l_, -kRcIncr);
+
+  void enter(record *r) {
+    r->epoch = epoch_ + 1;
+    memory_barrier();
   }
 
-  read_write_mutex(): l_(0), write_pending_(0) {}
+  void leave(record *r) {
+    memory_barrier();
+    r->epoch = 0;
+  }
+
+  // Waits for the readers which entered before this call.
+  void synchronize() {
+    memory_barrier();
+    atomic_add(&epoch_, 1);
+    const long target = epoch_ + 1;
+    for (record *r = head_; r; r = r->next) {
+      for (;;) {
+        const long e = r->epoch;
+        if (e == 0 || e >= target) {
+          break;
+        }
+        yield_processor();
+      }
+    }
+  }
+
+  epoch_domain(): head_(0), lock_(0), epoch_(0) {}
+  ~epoch_domain() {
+    while (head_) {
+      record *next = head_->next;
+      delete head_;
+      head_ = next;
+    }
+  }
 
  private:
-  static const int kWaFlag = 0x1;
-  static const int kRcIncr = 0x2;
+  record * volatile head_;
 #ifdef HAVE_OSX_ATOMIC_OPS
-  volatile int l_;
-  volatile int write_pending_;
+  volatile int lock_;
+  volatile int epoch_;
 #else
-  long l_;
-  long write_pending_;
+  long lock_;
+  volatile long epoch_;
 #endif
 };
 
-class scoped_writer_lock {
+class scoped_epoch_reader {
+ public:
+  scoped_epoch_reader(epoch_domain *domain, epoch_domain::record *r)
+      : domain_(domain), record_(r) {
+    domain_->enter(record_);
+  }
+  ~scoped_epoch_reader() {
+    domain_->leave(record_);
+  }
+ private:
+  epoch_domain         *domain_;
+  epoch_domain::record *record_;
+};
+#endif  // HAVE_ATOMIC_OPS
+
+class mutex {
  public:
-  scoped_writer_lock(read_write_mutex *mutex) : mutex_(mutex) {
-    mutex_->write_lock();
+  void lock() {
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&hnd);
+#else
+#ifdef _WIN32
+    ::EnterCriticalSection(&hnd);
+#endif
+#endif
   }
-  ~scoped_writer_lock() {
-    mutex_->write_unlock();
+
+  void unlock() {
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&hnd);
+#else
+#ifdef _WIN32
+    ::LeaveCriticalSection(&hnd);
+#endif
+#endif
+  }
+
+  mutex() {
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&hnd, 0);
+#else
+#ifdef _WIN32
+    ::InitializeCriticalSection(&hnd);
+#endif
+#endif
   }
+
+  ~mutex() {
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&hnd);
+#else
+#ifdef _WIN32
+    ::DeleteCriticalSection(&hnd);
+#endif
+#endif
+  }
+
  private:
-  read_write_mutex *mutex_;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t hnd;
+#else
+#ifdef _WIN32
+  CRITICAL_SECTION hnd;
+#endif
+#endif
 };
 
-class scoped_reader_lock {
+class scoped_lock {
  public:
-  scoped_reader_lock(read_write_mutex *mutex) : mutex_(mutex) {
-    mutex_->read_lock();
+  explicit scoped_lock(mutex *m) : mutex_(m) {
+    mutex_->lock();
   }
-  ~scoped_reader_lock() {
-    mutex_->read_unlock();
+  ~scoped_lock() {
+    mutex_->unlock();
   }
  private:
-  read_write_mutex *mutex_;
+  mutex *mutex_;
 };
-#endif  // HAVE_ATOMIC_OPS
 
 class thread {
  private:
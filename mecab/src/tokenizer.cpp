@@ -16,6 +16,20 @@
 namespace MeCab {
 namespace {
 
+#ifdef HAVE_OSX_ATOMIC_OPS
+volatile int tokenizer_serial = 0;
+#else
+volatile long tokenizer_serial = 0;
+#endif
+
+size_t next_tokenizer_serial() {
+#ifdef HAVE_ATOMIC_OPS
+  return static_cast<size_t>(atomic_add(&tokenizer_serial, 1));
+#else
+  return static_cast<size_t>(++tokenizer_serial);
+#endif
+}
+
 void inline read_node_info(const Dictionary &dic,
                            const Token &token,
                            LearnerNode **node) {
@@ -35,6 +49,28 @@ void inline read_node_info(const Dictionary &dic,
   (*node)->wcost   = token.wcost;
   (*node)->feature = dic.feature(token);
 }
+
+// A node for lookup(). Only the fields which read_node_info() and
+// lookup() do not write are cleared, rather than the whole node.
+inline LearnerNode *new_lookup_node(
+    Allocator<LearnerNode, LearnerPath> *allocator) {
+  return allocator->newNode();
+}
+
+inline Node *new_lookup_node(Allocator<Node, Path> *allocator) {
+  Node *node = allocator->newRawNode();
+  node->prev   = 0;
+  node->next   = 0;
+  node->enext  = 0;
+  node->rpath  = 0;
+  node->lpath  = 0;
+  node->isbest = 0;
+  node->alpha  = 0.0;
+  node->beta   = 0.0;
+  node->prob   = 0.0;
+  node->cost   = 0;
+  return node;
+}
 }  // namespace
 
 template class Tokenizer<Node, Path>;
@@ -55,7 +91,7 @@ template Node* Tokenizer<Node, Path>::lookup<true>(
     const char *,
     Allocator<Node, Path> *,
     Lattice *) const;
-template bool Tokenizer<Node, Path>::open(const Param &);
+template bool Tokenizer<Node, Path>::open(const Param &, const Bundle *);
 template Tokenizer<LearnerNode, LearnerPath>::Tokenizer();
 template void Tokenizer<LearnerNode, LearnerPath>::close();
 template const DictionaryInfo
@@ -68,13 +104,16 @@ template LearnerNode *Tokenizer<LearnerNode, LearnerPath>::lookup<false>(
     const char *,
     const char *,
     Allocator<LearnerNode, LearnerPath> *, Lattice *) const;
-template bool Tokenizer<LearnerNode, LearnerPath>::open(const Param &);
+template bool Tokenizer<LearnerNode, LearnerPath>::open(const Param &,
+                                                        const Bundle *);
 
 template <typename N, typename P>
 Tokenizer<N, P>::Tokenizer()
     : dictionary_info_freelist_(4),
       dictionary_info_(0),
-      max_grouping_size_(0) {}
+      max_grouping_size_(0),
+      lookup_cache_size_(0),
+      serial_(0) {}
 
 template <typename N, typename P>
 N *Tokenizer<N, P>::getBOSNode(Allocator<N, P> *allocator) const {
@@ -94,27 +133,37 @@ N *Tokenizer<N, P>::getEOSNode(Allocator<N, P> *allocator) const {
 }
 
 template <typename N, typename P>
-bool Tokenizer<N, P>::open(const Param &param) {
+bool Tokenizer<N, P>::open(const Param &param, const Bundle *bundle) {
   close();
 
   const std::string prefix = param.template get<std::string>("dicdir");
-
-  CHECK_FALSE(unkdic_.open(create_filename
-                                 (prefix, UNK_DIC_FILE).c_str()))
-      << unkdic_.what();
-  CHECK_FALSE(property_.open(param)) << property_.what();
+  const std::string mode = dictionary_mode(param);
+
+  if (bundle) {
+    CHECK_FALSE(unkdic_.open(*bundle, UNK_DIC_FILE)) << unkdic_.what();
+  } else {
+    CHECK_FALSE(unkdic_.open(create_filename
+                             (prefix, UNK_DIC_FILE).c_str(), mode.c_str()))
+        << unkdic_.what();
+  }
+  CHECK_FALSE(property_.open(param, bundle)) << property_.what();
 
   Dictionary *sysdic = new Dictionary;
+  dic_.push_back(sysdic);
 
-  CHECK_FALSE(sysdic->open
-                    (create_filename(prefix, SYS_DIC_FILE).c_str()))
-      << sysdic->what();
+  if (bundle) {
+    CHECK_FALSE(sysdic->open(*bundle, SYS_DIC_FILE)) << sysdic->what();
+  } else {
+    CHECK_FALSE(sysdic->open
+                (create_filename(prefix, SYS_DIC_FILE).c_str(),
+                 mode.c_str()))
+        << sysdic->what();
+  }
 
   CHECK_FALSE(sysdic->type() == 0)
       << "not a system dictionary: " << prefix;
 
   property_.set_charset(sysdic->charset());
-  dic_.push_back(sysdic);
 
   const std::string userdic = param.template get<std::string>("userdic");
   if (!userdic.empty()) {
@@ -124,7 +173,7 @@ bool Tokenizer<N, P>::open(const Param &param) {
     const size_t n = tokenizeCSV(buf.get(), dicfile.get(), dicfile.size());
     for (size_t i = 0; i < n; ++i) {
       Dictionary *d = new Dictionary;
-      CHECK_FALSE(d->open(dicfile[i])) << d->what();
+      CHECK_FALSE(d->open(dicfile[i], mode.c_str())) << d->what();
       CHECK_FALSE(d->type() == 1)
           << "not a user dictionary: " << dicfile[i];
       CHECK_FALSE(sysdic->isCompatible(*d))
@@ -133,6 +182,10 @@ bool Tokenizer<N, P>::open(const Param &param) {
     }
   }
 
+  for (size_t i = 0; i < dic_.size(); ++i) {
+    double_arrays_.push_back(dic_[i]->double_array());
+  }
+
   dictionary_info_ = 0;
   dictionary_info_freelist_.free();
   for (int i = static_cast<int>(dic_.size() - 1); i >= 0; --i) {
@@ -176,19 +229,76 @@ bool Tokenizer<N, P>::open(const Param &param) {
     max_grouping_size_ = DEFAULT_MAX_GROUPING_SIZE;
   }
 
+  // the lookup caches of the lattices see a new serial number and drop
+  // the nodes of the dictionaries opened before.
+  lookup_cache_size_ = param.template get<size_t>("lookup-cache");
+  serial_ = next_tokenizer_serial();
+
   return true;
 }
 
 namespace {
+const size_t kMaxCSVFields = 64;
+
+// Finds the next field of |*str| the way tokenizeCSV() splits an
+// unquoted line, without copying it. |n| is the number of fields
+// already read; the last allowed field takes the rest of the line.
+inline bool next_csv_field(const char **str, const char *eos, size_t n,
+                           const char **begin, const char **end) {
+  if (*str >= eos) {
+    return false;
+  }
+  while (**str == ' ' || **str == '\t') ++*str;
+  *begin = *str;
+  *end = (n + 1 == kMaxCSVFields) ? eos : std::find(*str, eos, ',');
+  *str = *end + 1;
+  return true;
+}
+
+// Compares the fields of |f1| and |f2| in place. Returns false in
+// |*matched| if a field differs. Returns false if either contains a
+// quote, which needs the unescaping of tokenizeCSV().
+inline bool partial_match_unquoted(const char *f1, const char *f2,
+                                   bool *matched) {
+  const size_t len1 = std::strlen(f1);
+  const size_t len2 = std::strlen(f2);
+  if (len1 >= BUF_SIZE || len2 >= BUF_SIZE ||
+      std::memchr(f1, '"', len1) || std::memchr(f2, '"', len2)) {
+    return false;
+  }
+
+  const char *eos1 = f1 + len1;
+  const char *eos2 = f2 + len2;
+  const char *b1, *e1, *b2, *e2;
+  *matched = true;
+  for (size_t n = 0;
+       next_csv_field(&f1, eos1, n, &b1, &e1) &&
+           next_csv_field(&f2, eos2, n, &b2, &e2); ++n) {
+    if (e1 - b1 == 1 && *b1 == '*') {
+      continue;
+    }
+    if (e1 - b1 != e2 - b2 || std::memcmp(b1, b2, e1 - b1) != 0) {
+      *matched = false;
+      break;
+    }
+  }
+  return true;
+}
+
 inline bool partial_match(const char *f1, const char *f2) {
   if (std::strcmp(f1, "*") == 0) {
     return true;
   }
 
+  bool matched = false;
+  if (partial_match_unquoted(f1, f2, &matched)) {
+    return matched;
+  }
+
   scoped_fixed_array<char, BUF_SIZE> buf1;
   scoped_fixed_array<char, BUF_SIZE> buf2;
-  scoped_fixed_array<char *, 64> c1;
-  scoped_fixed_array<char *, 64> c2;
+  scoped_fixed_array<char *, kMaxCSVFields> c1;
+  scoped_fixed_array<char *, kMaxCSVFields> c2;
 
   std::strncpy(buf1.get(), f1, buf1.size());
   std::strncpy(buf2.get(), f2, buf2.size());
@@ -232,7 +342,7 @@ bool is_valid_node(const Lattice *lattice,  N *node) {
     const Token *token = unk_tokens_[cinfo.default_type].first;          \
     size_t size  = unk_tokens_[cinfo.default_type].second;               \
     for (size_t k = 0; k < size; ++k) {                                  \
-      N *new_node = allocator->newNode();                                \
+      N *new_node = new_lookup_node(allocator);                          \
       read_node_info(unkdic_, *(token + k), &new_node);                  \
       new_node->char_type = cinfo.default_type;                          \
       new_node->surface = begin2;                                        \
@@ -248,6 +358,61 @@ template <typename N, typename P>
 template <bool isPartial>
 N *Tokenizer<N, P>::lookup(const char *begin, const char *end,
                            Allocator<N, P> *allocator, Lattice *lattice) const {
+  if (!isPartial && lookup_cache_size_) {
+    return cachedLookup(begin, end, allocator, lattice);
+  }
+  return lookupNodes<isPartial>(begin, end, allocator, lattice, 0);
+}
+
+template <typename N, typename P>
+N *Tokenizer<N, P>::cachedLookup(const char *begin, const char *end,
+                                 Allocator<N, P> *allocator,
+                                 Lattice *lattice) const {
+  typedef typename LookupCache<N>::Entry Entry;
+
+  end = static_cast<size_t>(end - begin) >= 65535 ? begin + 65535 : end;
+  const size_t size = std::min(static_cast<size_t>(end - begin),
+                               LookupCache<N>::kWindowSize);
+  const uint64_t hash = fingerprint(begin, size);
+
+  LookupCache<N> *cache = allocator->lookup_cache();
+  if (cache->owner() != serial_) {
+    cache->reset(lookup_cache_size_, serial_);
+  }
+
+  const Entry *entry = cache->find(begin, size, hash);
+  if (entry) {
+    // allocates the nodes in the order lookupNodes() did, so that they
+    // get the same ids.
+    N *result_node = 0;
+    for (size_t i = entry->node.size(); i-- > 0;) {
+      N *new_node = allocator->newNode(entry->node[i]);
+      new_node->surface = begin + new_node->rlength - new_node->length;
+      new_node->bnext = result_node;
+      result_node = new_node;
+    }
+    return result_node;
+  }
+
+  const char *scan_end = begin;
+  N *result_node = lookupNodes<false>(begin, end, allocator, lattice,
+                                      &scan_end);
+  if (size < LookupCache<N>::kWindowSize ||
+      scan_end < begin + LookupCache<N>::kWindowSize) {
+    Entry *e = cache->insert(begin, size, hash);
+    for (const N *node = result_node; node; node = node->bnext) {
+      e->node.push_back(*node);
+    }
+  }
+
+  return result_node;
+}
+
+template <typename N, typename P>
+template <bool isPartial>
+N *Tokenizer<N, P>::lookupNodes(const char *begin, const char *end,
+                                Allocator<N, P> *allocator, Lattice *lattice,
+                                const char **scan_end) const {
   CharInfo cinfo;
   N *result_node = 0;
   size_t mblen = 0;
@@ -267,22 +432,42 @@ N *Tokenizer<N, P>::lookup(const char *begin, const char *end,
 
   const char *begin2 = property_.seekToOtherType(begin, end, space_,
                                                  &cinfo, &mblen, &clen);
+  const char *scanned = begin2 + mblen;
+  if (scan_end) {
+    for (size_t i = 0; i < dic_.size(); ++i) {
+      scanned = std::max(scanned, begin2 + dic_[i]->prefixDepth(
+          begin2, static_cast<size_t>(end - begin2)));
+    }
+  }
 
-  Dictionary::result_type *daresults = allocator->mutable_results();
+  // With user dictionaries, all the tries walk the input in lockstep,
+  // so that it is traversed once rather than once per dictionary.
+  const size_t dic_size = dic_.size();
   const size_t results_size = allocator->results_size();
-
-  for (std::vector<Dictionary *>::const_iterator it = dic_.begin();
-       it != dic_.end(); ++it) {
-    const size_t n = (*it)->commonPrefixSearch(
+  Dictionary::result_type *results = allocator->mutable_results(dic_size);
+  size_t *results_num = allocator->mutable_results_num();
+  if (dic_size == 1) {
+    results_num[0] = dic_[0]->commonPrefixSearch(
         begin2,
         static_cast<size_t>(end - begin2),
-        daresults, results_size);
+        results, results_size);
+  } else {
+    Darts::DoubleArray::commonPrefixSearch(
+        &double_arrays_[0], dic_size, begin2,
+        results, results_size, results_num,
+        static_cast<size_t>(end - begin2));
+  }
+
+  for (size_t d = 0; d < dic_size; ++d) {
+    const Dictionary &dic = *dic_[d];
+    const Dictionary::result_type *daresults = results + d * results_size;
+    const size_t n = std::min(results_num[d], results_size);
     for (size_t i = 0; i < n; ++i) {
-      size_t size = (*it)->token_size(daresults[i]);
-      const Token *token = (*it)->token(daresults[i]);
+      size_t size = dic.token_size(daresults[i]);
+      const Token *token = dic.token(daresults[i]);
       for (size_t j = 0; j < size; ++j) {
-        N *new_node = allocator->newNode();
-        read_node_info(**it, *(token + j), &new_node);
+        N *new_node = new_lookup_node(allocator);
+        read_node_info(dic, *(token + j), &new_node);
         new_node->length = daresults[i].length;
         new_node->rlength = begin2 - begin + new_node->length;
         new_node->surface = begin2;
@@ -298,6 +483,7 @@ N *Tokenizer<N, P>::lookup(const char *begin, const char *end,
   }
 
   if (result_node && !cinfo.invoke) {
+    if (scan_end) *scan_end = scanned;
     return result_node;
   }
 
@@ -307,6 +493,7 @@ N *Tokenizer<N, P>::lookup(const char *begin, const char *end,
   if (begin3 > end) {
     ADDUNKNWON;
     if (result_node) {
+      if (scan_end) *scan_end = scanned;
       return result_node;
     }
   }
@@ -316,6 +503,7 @@ N *Tokenizer<N, P>::lookup(const char *begin, const char *end,
     CharInfo fail;
     begin3 = property_.seekToOtherType(begin3, end, cinfo,
                                        &fail, &mblen, &clen);
+    scanned = std::max(scanned, begin3 + mblen);
     if (clen <= max_grouping_size_) {
       ADDUNKNWON;
     }
@@ -332,7 +520,10 @@ N *Tokenizer<N, P>::lookup(const char *begin, const char *end,
     }
     clen = i;
     ADDUNKNWON;
-    if (!cinfo.isKindOf(property_.getCharInfo(begin3, end, &mblen))) {
+    const bool kind = cinfo.isKindOf(property_.getCharInfo(begin3, end,
+                                                           &mblen));
+    scanned = std::max(scanned, begin3 + mblen);
+    if (!kind) {
       break;
     }
     begin3 += mblen;
@@ -370,6 +561,7 @@ N *Tokenizer<N, P>::lookup(const char *begin, const char *end,
     }
   }
 
+  if (scan_end) *scan_end = scanned;
   return result_node;
 }
 
@@ -387,6 +579,7 @@ void Tokenizer<N, P>::close() {
     delete *it;
   }
   dic_.clear();
+  double_arrays_.clear();
   unk_tokens_.clear();
   property_.close();
 }
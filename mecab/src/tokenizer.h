@@ -12,12 +12,138 @@
 #include "char_property.h"
 #include "nbest_generator.h"
 #include "scoped_ptr.h"
+#include "thread.h"
+#include "utils.h"
 
 namespace MeCab {
 
 class Param;
+class Bundle;
 class NBestGenerator;
 
+// End nodes at one position, gathered into structure-of-arrays form for
+// the 1-best connect() in viterbi.cpp. Costs are stored relative to
+// |base| so that the minimum search can run on 32-bit lanes.
+template <typename N>
+struct EndNodeArray {
+  std::vector<N *> node;
+  std::vector<int> rcAttr;
+  std::vector<int> cost;
+  long             base;
+  size_t           size;
+  std::vector<long> node_cost;  // scratch for the gathering
+  std::vector<long> beam_cost;  // scratch for the beam pruning
+  std::vector<N *>  path_node;  // scratch for the marginal probabilities
+  std::vector<double> score;    // scratch for the forward-backward
+  EndNodeArray(): base(0), size(0) {}
+
+  // bytes of the vectors.
+  size_t reserved_size() const {
+    return node.capacity() * sizeof(N *) +
+        (rcAttr.capacity() + cost.capacity()) * sizeof(int) +
+        (node_cost.capacity() + beam_cost.capacity()) * sizeof(long) +
+        path_node.capacity() * sizeof(N *) +
+        score.capacity() * sizeof(double);
+  }
+};
+
+// A cache of the node lists built by Tokenizer::lookup(), kept
+// per lattice so that the tokens and boilerplate repeated in a document
+// skip the trie walk, read_node_info() and the unknown word processing.
+// An entry is keyed on the next kWindowSize bytes at a position, or the
+// rest of the sentence if it is shorter. A list is stored only if its
+// lookup read no byte past the window, so a hit is exact. A node keeps
+// its surface as rlength - length bytes from the position.
+// When the cache is full, the entry evicted is chosen by the clock
+// algorithm (see insert()), an approximation of LRU.
+template <typename N>
+class LookupCache {
+ public:
+  static const size_t kWindowSize = 32;
+
+  struct Entry {
+    uint64_t            hash;
+    size_t              key_size;
+    char                key[kWindowSize];
+    std::vector<N>      node;     // in the order of the bnext list
+    int                 hnext;
+    bool                referenced;
+  };
+
+  // the serial number of the tokenizer whose nodes are cached.
+  size_t owner() const { return owner_; }
+
+  // Empties the cache and makes it hold |capacity| entries of |owner|.
+  void reset(size_t capacity, size_t owner) {
+    size_t bucket_size = 1;
+    while (bucket_size < 2 * capacity) {
+      bucket_size <<= 1;
+    }
+    bucket_.assign(bucket_size, -1);
+    entry_.clear();
+    entry_.reserve(capacity);
+    capacity_ = capacity;
+    owner_ = owner;
+    hand_ = 0;
+  }
+
+  const Entry *find(const char *key, size_t size, uint64_t hash) {
+    for (int i = bucket_[hash & (bucket_.size() - 1)]; i != -1;
+         i = entry_[i].hnext) {
+      const Entry &e = entry_[i];
+      if (e.hash == hash && e.key_size == size &&
+          std::memcmp(e.key, key, size) == 0) {
+        entry_[i].referenced = true;
+        return &e;
+      }
+    }
+    return 0;
+  }
+
+  // Returns an empty entry for |key|. When the cache is full, the
+  // entry evicted is chosen by the clock algorithm, which approximates
+  // LRU without relinking a list on every hit: the hand passes over the
+  // entries hit since its last round and takes the first one not hit.
+  Entry *insert(const char *key, size_t size, uint64_t hash) {
+    int i = 0;
+    if (entry_.size() < capacity_) {
+      i = static_cast<int>(entry_.size());
+      entry_.push_back(Entry());
+    } else {
+      while (entry_[hand_].referenced) {
+        entry_[hand_].referenced = false;
+        hand_ = (hand_ + 1) % entry_.size();
+      }
+      i = static_cast<int>(hand_);
+      hand_ = (hand_ + 1) % entry_.size();
+      int *p = &bucket_[entry_[i].hash & (bucket_.size() - 1)];
+      while (*p != i) {
+        p = &entry_[*p].hnext;
+      }
+      *p = entry_[i].hnext;
+    }
+    Entry &e = entry_[i];
+    std::memcpy(e.key, key, size);
+    e.key_size = size;
+    e.hash = hash;
+    e.node.clear();
+    int *b = &bucket_[hash & (bucket_.size() - 1)];
+    e.hnext = *b;
+    *b = i;
+    e.referenced = false;
+    return &e;
+  }
+
+  LookupCache(): capacity_(0), owner_(0), hand_(0) {}
+
+ private:
+  std::vector<Entry> entry_;
+  std::vector<int>   bucket_;
+  size_t             capacity_;
+  size_t             owner_;
+  size_t             hand_;
+};
+
 template <typename N, typename P>
 class Allocator {
  public:
@@ -28,6 +154,27 @@ class Allocator {
     return node;
   }
 
+  // newNode() without clearing the node, for the callers which write
+  // every field themselves. Define MECAB_POISON_NODES to fill the node
+  // with 0xa5 bytes instead, so that a field left unwritten changes
+  // the output.
+  N *newRawNode() {
+    N *node = node_freelist_->alloc();
+#ifdef MECAB_POISON_NODES
+    std::memset(node, 0xa5, sizeof(N));
+#endif
+    node->id = id_++;
+    return node;
+  }
+
+  // a copy of |node| with a new id.
+  N *newNode(const N &node) {
+    N *new_node = node_freelist_->alloc();
+    *new_node = node;
+    new_node->id = id_++;
+    return new_node;
+  }
+
   P *newPath() {
     if (!path_freelist_.get()) {
       path_freelist_.reset(new FreeList<P>(PATH_FREELIST_SIZE));
@@ -35,8 +182,18 @@ class Allocator {
     return path_freelist_->alloc();
   }
 
-  Dictionary::result_type *mutable_results() {
-    return results_.get();
+  // results_size() entries per dictionary for |n| dictionaries.
+  Dictionary::result_type *mutable_results(size_t n) {
+    if (results_.size() < n * kResultsSize) {
+      results_.resize(n * kResultsSize);
+      results_num_.resize(n);
+    }
+    return &results_[0];
+  }
+
+  // the number of results of each dictionary.
+  size_t *mutable_results_num() {
+    return &results_num_[0];
   }
 
   char *alloc(size_t size) {
@@ -59,8 +216,30 @@ class Allocator {
     return nbest_generator_.get();
   }
 
+  EndNodeArray<N> *end_node_array() {
+    if (!end_node_array_.get()) {
+      end_node_array_.reset(new EndNodeArray<N>);
+    }
+    return end_node_array_.get();
+  }
+
+  LookupCache<N> *lookup_cache() {
+    if (!lookup_cache_.get()) {
+      lookup_cache_.reset(new LookupCache<N>);
+    }
+    return lookup_cache_.get();
+  }
+
+  // A trimmed buffer is released here rather than in trim(), as the
+  // features of the constraints of a partial parse point into it until
+  // the sentence is set.
   char *partial_buffer(size_t size) {
-    partial_buffer_.resize(size);
+    if (partial_buffer_trimmed_) {
+      std::vector<char>(size).swap(partial_buffer_);
+      partial_buffer_trimmed_ = false;
+    } else {
+      partial_buffer_.resize(size);
+    }
     return &partial_buffer_[0];
   }
 
@@ -68,6 +247,18 @@ class Allocator {
     return kResultsSize;
   }
 
+#ifdef HAVE_ATOMIC_OPS
+  // Reader record of |domain|, owned by this allocator and thus used
+  // by one thread at a time.
+  epoch_domain::record *epoch_record(epoch_domain *domain) {
+    if (!epoch_record_) {
+      epoch_domain_ = domain;
+      epoch_record_ = domain->acquire();
+    }
+    return epoch_record_;
+  }
+#endif
+
   void free() {
     id_ = 0;
     node_freelist_->free();
@@ -79,14 +270,68 @@ class Allocator {
     }
   }
 
+  // Releases the memory kept for the next sentences, but the first
+  // block of each list. Call it after free(). The partial buffer is
+  // released by the next partial_buffer(). The scratch of the search,
+  // the n-best generator and the lookup cache are made again when
+  // they are used; the cache starts empty.
+  void trim() {
+    node_freelist_->trim();
+    if (path_freelist_.get()) {
+      path_freelist_->trim();
+    }
+    if (char_freelist_.get()) {
+      char_freelist_->trim();
+    }
+    partial_buffer_trimmed_ = true;
+    end_node_array_.reset(0);
+    nbest_generator_.reset(0);
+    lookup_cache_.reset(0);
+  }
+
+  // bytes of the blocks of nodes, paths and strings, and of the
+  // scratch of the search and the n-best generator. The lookup cache
+  // is not counted, as --lookup-cache bounds it.
+  size_t reserved_size() const {
+    return node_freelist_->reserved_size() * sizeof(N) +
+        (path_freelist_.get() ?
+         path_freelist_->reserved_size() * sizeof(P) : 0) +
+        (char_freelist_.get() ? char_freelist_->reserved_size() : 0) +
+        (partial_buffer_trimmed_ ? 0 : partial_buffer_.capacity()) +
+        (end_node_array_.get() ? end_node_array_->reserved_size() : 0) +
+        (nbest_generator_.get() ? nbest_generator_->reserved_size() : 0);
+  }
+
+  // bytes allocated from the blocks for the current sentence.
+  size_t used_size() const {
+    return node_freelist_->used_size() * sizeof(N) +
+        (path_freelist_.get() ? path_freelist_->used_size() * sizeof(P) : 0) +
+        (char_freelist_.get() ? char_freelist_->used_size() : 0) +
+        partial_buffer_.size();
+  }
+
   Allocator()
       : id_(0),
         node_freelist_(new FreeList<N>(NODE_FREELIST_SIZE)),
         path_freelist_(0),
         char_freelist_(0),
         nbest_generator_(0),
-        results_(new Dictionary::result_type[kResultsSize]) {}
-  virtual ~Allocator() {}
+        end_node_array_(0),
+        lookup_cache_(0),
+#ifdef HAVE_ATOMIC_OPS
+        epoch_domain_(0),
+        epoch_record_(0),
+#endif
+        results_(kResultsSize),
+        results_num_(1),
+        partial_buffer_trimmed_(false) {}
+  virtual ~Allocator() {
+#ifdef HAVE_ATOMIC_OPS
+    if (epoch_record_) {
+      epoch_domain_->release(epoch_record_);
+    }
+#endif
+  }
 
  private:
   static const size_t kResultsSize = 512;
@@ -95,14 +340,23 @@ class Allocator {
   scoped_ptr<FreeList<P> > path_freelist_;
   scoped_ptr<ChunkFreeList<char>  >  char_freelist_;
   scoped_ptr<NBestGenerator>  nbest_generator_;
+  scoped_ptr<EndNodeArray<N> > end_node_array_;
+  scoped_ptr<LookupCache<N> > lookup_cache_;
   std::vector<char> partial_buffer_;
-  scoped_array<Dictionary::result_type>  results_;
+#ifdef HAVE_ATOMIC_OPS
+  epoch_domain         *epoch_domain_;
+  epoch_domain::record *epoch_record_;
+#endif
+  std::vector<Dictionary::result_type>  results_;
+  std::vector<size_t>                   results_num_;
+  bool partial_buffer_trimmed_;
 };
 
 template <typename N, typename P>
 class Tokenizer {
  private:
   std::vector<Dictionary *>              dic_;
+  std::vector<const Darts::DoubleArray *> double_arrays_;
   Dictionary                             unkdic_;
   scoped_string                          bos_feature_;
   scoped_string                          unk_feature_;
@@ -112,19 +366,49 @@ class Tokenizer {
   CharInfo                               space_;
   CharProperty                           property_;
   size_t                                 max_grouping_size_;
+  size_t                                 lookup_cache_size_;
+  size_t                                 serial_;
   whatlog                                what_;
 
+  // lookup() without the cache. If |scan_end| is given, it receives
+  // the end of the bytes the lookup has read.
+  template <bool IsPartial> N *lookupNodes(const char *begin,
+                                           const char *end,
+                                           Allocator<N, P> *allocator,
+                                           Lattice *lattice,
+                                           const char **scan_end) const;
+  N *cachedLookup(const char *begin, const char *end,
+                  Allocator<N, P> *allocator, Lattice *lattice) const;
+
  public:
   N *getBOSNode(Allocator<N, P> *allocator) const;
   N *getEOSNode(Allocator<N, P> *allocator) const;
   template <bool IsPartial> N *lookup(const char *begin, const char *end,
                                       Allocator<N, P> *allocator,
                                       Lattice *lattice) const;
-  bool open(const Param &param);
+  // reads unk.dic, char.bin and sys.dic from |bundle| when given.
+  // User dictionaries are always separate files.
+  bool open(const Param &param, const Bundle *bundle = 0);
   void close();
 
   const DictionaryInfo *dictionary_info() const;
 
+  // The dictionaries of dictionary_info(), in the same order.
+  size_t dictionary_size() const { return dic_.size(); }
+  const Dictionary *dictionary(size_t i) const { return dic_[i]; }
+  const Dictionary *unknown_dictionary() const { return &unkdic_; }
+  const CharProperty *char_property() const { return &property_; }
+
+  // Returns the dictionary which owns |feature|, or NULL.
+  const Dictionary *feature_dictionary(const char *feature) const {
+    for (size_t i = 0; i < dic_.size(); ++i) {
+      if (dic_[i]->has_feature(feature)) {
+        return dic_[i];
+      }
+    }
+    return unkdic_.has_feature(feature) ? &unkdic_ : 0;
+  }
+
   const char *what() { return what_.str(); }
 
   explicit Tokenizer();
@@ -3,6 +3,7 @@
 //
 //  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
@@ -15,6 +16,10 @@
 #include <sys/types.h>
 #endif
 
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
 #ifdef HAVE_DIRENT_H
 #include <dirent.h>
 #endif
@@ -27,6 +32,12 @@
 
 #include <stdint.h>
 
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #if defined(_WIN32) && !defined(__CYGWIN__)
 extern HINSTANCE DllInstance;
 #endif
@@ -36,6 +47,10 @@ extern HINSTANCE DllInstance;
 #include "param.h"
 #include "utils.h"
 
+#ifdef MECAB_USE_AVX2
+#include <immintrin.h>
+#endif
+
 namespace MeCab {
 
 #if defined(_WIN32) && !defined(__CYGWIN__)
@@ -271,11 +286,23 @@ int load_request_type(const Param &param) {
     request_type |= MECAB_MARGINAL_PROB;
   }
 
+  if (param.get<bool>("marginal-without-path")) {
+    request_type |= MECAB_MARGINAL_WITHOUT_PATH;
+  }
+
+  if (param.get<int>("beam") > 0) {
+    request_type |= MECAB_BEAM;
+  }
+
   const int nbest = param.get<int>("nbest");
   if (nbest >= 2) {
     request_type |= MECAB_NBEST;
   }
 
+  if (param.get<bool>("nbest-unique")) {
+    request_type |= MECAB_NBEST_UNIQUE;
+  }
+
   // DEPRECATED:
   const int lattice_level = param.get<int>("lattice-level");
   if (lattice_level >= 1) {
@@ -382,6 +409,13 @@ bool load_dictionary_resource(Param *param) {
   remove_filename(&rcfile);
   replace_string(&dicdir, "$(rcpath)", rcfile);
   param->set<std::string>("dicdir", dicdir, true);
+
+  // a dictionary bundle carries its dicrc as a section, which the
+  // tagger reads when it opens the bundle.
+  if (is_regular_file(dicdir.c_str())) {
+    return true;
+  }
+
   dicdir = create_filename(dicdir, DICRC);
 
   if (!param->load(dicdir.c_str())) {
@@ -554,6 +588,138 @@ uint64_t fingerprint(const std::string &str) {
   return fingerprint(str.data(), str.size());
 }
 
+namespace {
+// exp(d) is computed as 2^n * exp(r), where n is the integer nearest to
+// d / log(2) and |r| <= log(2) / 2. Adding kRoundMagic (1.5 * 2^52)
+// rounds d / log(2) and leaves n in the low bits, from which 2^n is
+// made. exp(r) is its Taylor series up to r^7.
+const double kLog2e = 1.4426950408889634;
+const double kLn2 = 0.6931471805599453;
+const double kRoundMagic = 6755399441055744.0;
+const size_t kExpTerms = 8;
+const double kExpCoeff[kExpTerms] = {
+  1.0 / 5040, 1.0 / 720, 1.0 / 120, 1.0 / 24, 1.0 / 6, 1.0 / 2, 1.0, 1.0
+};
+// the sums are split in four, one per AVX2 lane.
+const size_t kExpLanes = 4;
+
+inline double fast_exp(double d) {
+  const double t = d * kLog2e + kRoundMagic;
+  const double n = t - kRoundMagic;
+  const double r = d - n * kLn2;
+  double p = kExpCoeff[0];
+  for (size_t k = 1; k < kExpTerms; ++k) {
+    p = p * r + kExpCoeff[k];
+  }
+  uint64_t bits = 0;
+  std::memcpy(&bits, &t, sizeof(bits));
+  bits = (bits + 1023) << 52;
+  double scale = 0.0;
+  std::memcpy(&scale, &bits, sizeof(scale));
+  return p * scale;
+}
+
+typedef double (*ExpSumFunc)(const double *x, size_t size, double shift);
+
+double exp_sum_scalar(const double *x, size_t size, double shift) {
+  double sum[kExpLanes] = { 0.0, 0.0, 0.0, 0.0 };
+  for (size_t i = 0; i < size; ++i) {
+    const double d = x[i] - shift;
+    if (d >= -MINUS_LOG_EPSILON) {
+      sum[i % kExpLanes] += fast_exp(d);
+    }
+  }
+  return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+#ifdef MECAB_USE_AVX2
+// The same operations as exp_sum_scalar() in the same order, so that
+// both return the same sum.
+__attribute__((target("avx2")))
+double exp_sum_avx2(const double *x, size_t size, double shift) {
+  const __m256d vshift = _mm256_set1_pd(shift);
+  const __m256d vmin = _mm256_set1_pd(-MINUS_LOG_EPSILON);
+  const __m256d vlog2e = _mm256_set1_pd(kLog2e);
+  const __m256d vln2 = _mm256_set1_pd(kLn2);
+  const __m256d vmagic = _mm256_set1_pd(kRoundMagic);
+  const __m256i vbias = _mm256_set1_epi64x(1023);
+  __m256d vsum = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + kExpLanes <= size; i += kExpLanes) {
+    const __m256d d = _mm256_sub_pd(_mm256_loadu_pd(x + i), vshift);
+    const __m256d t = _mm256_add_pd(_mm256_mul_pd(d, vlog2e), vmagic);
+    const __m256d n = _mm256_sub_pd(t, vmagic);
+    const __m256d r = _mm256_sub_pd(d, _mm256_mul_pd(n, vln2));
+    __m256d p = _mm256_set1_pd(kExpCoeff[0]);
+    for (size_t k = 1; k < kExpTerms; ++k) {
+      p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(kExpCoeff[k]));
+    }
+    const __m256i bits = _mm256_slli_epi64(
+        _mm256_add_epi64(_mm256_castpd_si256(t), vbias), 52);
+    const __m256d e = _mm256_mul_pd(p, _mm256_castsi256_pd(bits));
+    // the scores below the cut-off may give garbage, which is masked.
+    vsum = _mm256_add_pd(vsum, _mm256_and_pd(
+        e, _mm256_cmp_pd(d, vmin, _CMP_GE_OQ)));
+  }
+
+  double sum[kExpLanes];
+  _mm256_storeu_pd(sum, vsum);
+  for (; i < size; ++i) {
+    const double d = x[i] - shift;
+    if (d >= -MINUS_LOG_EPSILON) {
+      sum[i % kExpLanes] += fast_exp(d);
+    }
+  }
+  return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+#endif
+
+ExpSumFunc select_exp_sum() {
+#ifdef MECAB_USE_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return &exp_sum_avx2;
+  }
+#endif
+  return &exp_sum_scalar;
+}
+
+const ExpSumFunc exp_sum = select_exp_sum();
+}  // namespace
+
+double logsumexp(const double *x, size_t size, bool fast) {
+  // |kept| is an upper bound of the scores within the cut-off from the
+  // maximum: the scores not counted are below it by more than that. In
+  // a lattice, the others are mostly far below the maximum, and then
+  // neither exp() nor log() is needed.
+  double vmax = x[0];
+  size_t kept = 1;
+  for (size_t i = 1; i < size; ++i) {
+    if (x[i] > vmax) {
+      kept = x[i] > vmax + MINUS_LOG_EPSILON ? 1 : kept + 1;
+      vmax = x[i];
+    } else if (x[i] >= vmax - MINUS_LOG_EPSILON) {
+      ++kept;
+    }
+  }
+  if (kept == 1) {
+    return vmax;
+  }
+
+  double sum = 0.0;
+  if (fast) {
+    sum = exp_sum(x, size, vmax);
+  } else {
+    for (size_t i = 0; i < size; ++i) {
+      const double d = x[i] - vmax;
+      if (d >= -MINUS_LOG_EPSILON) {
+        sum += std::exp(d);
+      }
+    }
+  }
+  return vmax + std::log(sum);
+}
+
 bool file_exists(const char *filename) {
   std::ifstream ifs(WPATH(filename));
   if (!ifs) {
@@ -561,4 +727,102 @@ bool file_exists(const char *filename) {
   }
   return true;
 }
+
+bool is_regular_file(const char *filename) {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+  const DWORD attr = ::GetFileAttributesW(WPATH_FORCE(filename));
+  return (attr != INVALID_FILE_ATTRIBUTES &&
+          !(attr & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE)));
+#elif defined(HAVE_SYS_STAT_H)
+  struct stat st;
+  return ::stat(filename, &st) == 0 && S_ISREG(st.st_mode);
+#else
+  return false;
+#endif
+}
+
+std::string dictionary_mode(const Param &param) {
+  std::string mode = "r";
+  if (param.get<bool>("load-dictionary")) {
+    mode += 'p';
+  }
+  if (param.get<bool>("prefault-dictionary")) {
+    mode += 'f';
+  }
+  if (param.get<bool>("hugepage-dictionary")) {
+    mode += 'h';
+  }
+  return mode;
+}
+
+void get_page_stat(const void *ptr, size_t size, PageStat *stat) {
+  stat->size = size;
+  stat->page_size = 4096;
+  stat->resident = 0;
+  stat->huge = 0;
+  stat->known = false;
+#ifdef __linux__
+  stat->page_size = ::sysconf(_SC_PAGESIZE);
+#endif
+  const size_t begin = reinterpret_cast<size_t>(ptr) /
+      stat->page_size * stat->page_size;
+  const size_t end = reinterpret_cast<size_t>(ptr) + size;
+  stat->pages = (end - begin + stat->page_size - 1) / stat->page_size;
+  if (!size) {
+    return;
+  }
+
+#ifdef __linux__
+  std::vector<unsigned char> vec(stat->pages);
+  if (::mincore(reinterpret_cast<void *>(begin), end - begin, &vec[0]) != 0) {
+    return;
+  }
+  for (size_t i = 0; i < vec.size(); ++i) {
+    stat->resident += (vec[i] & 1);
+  }
+
+  // The huge pages of a mapping are only reported per mapping, so
+  // those of mappings larger than the region are counted up to the
+  // overlap.
+  std::ifstream ifs("/proc/self/smaps");
+  std::string line;
+  size_t overlap = 0;
+  while (std::getline(ifs, line)) {
+    unsigned long from = 0, to = 0;
+    if (std::sscanf(line.c_str(), "%lx-%lx ", &from, &to) == 2 &&
+        line.find(':') > line.find(' ')) {
+      overlap = (from < end && to > begin) ?
+          std::min<size_t>(to, end) - std::max<size_t>(from, begin) : 0;
+      continue;
+    }
+    unsigned long kb = 0;
+    if (overlap &&
+        (std::sscanf(line.c_str(), "AnonHugePages: %lu kB", &kb) == 1 ||
+         std::sscanf(line.c_str(), "FilePmdMapped: %lu kB", &kb) == 1)) {
+      stat->huge += std::min<size_t>(1024 * kb, overlap);
+    }
+  }
+  stat->huge = std::min(stat->huge, end - begin);
+  stat->known = true;
+#endif
+}
+
+int current_numa_node() {
+#ifdef __linux__
+  const int cpu = ::sched_getcpu();
+  if (cpu < 0) {
+    return 0;
+  }
+  const int kMaxNumaNodes = 64;
+  char path[64];
+  for (int node = 0; node < kMaxNumaNodes; ++node) {
+    std::snprintf(path, sizeof(path),
+                  "/sys/devices/system/node/node%d/cpu%d", node, cpu);
+    if (::access(path, F_OK) == 0) {
+      return node;
+    }
+  }
+#endif
+  return 0;
+}
 }  // namespace MeCab
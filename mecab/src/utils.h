@@ -106,6 +106,28 @@ inline void read_static(const char **ptr, T& value) {
 
 bool file_exists(const char *filename);
 
+bool is_regular_file(const char *filename);
+
+// Mmap mode of the dictionary files, from the load-dictionary,
+// prefault-dictionary and hugepage-dictionary parameters.
+std::string dictionary_mode(const Param &param);
+
+// Page statistics of a memory region, shown by --dictionary-info.
+struct PageStat {
+  size_t size;       // bytes
+  size_t page_size;  // base page size
+  size_t pages;      // base pages spanned by the region
+  size_t resident;   // base pages present in memory
+  size_t huge;       // bytes backed by transparent huge pages
+  bool   known;      // false if |resident| and |huge| are unavailable
+};
+
+void get_page_stat(const void *ptr, size_t size, PageStat *stat);
+
+// NUMA node of the CPU the calling thread runs on. Always 0 where
+// the topology is not known.
+int current_numa_node();
+
 int load_request_type(const Param &param);
 
 bool load_dictionary_resource(Param *);
@@ -218,6 +240,14 @@ inline double logsumexp(double x, double y, bool flg) {
   }
 }
 
+// log(exp(x[0]) + ... + exp(x[size - 1])) of |size| > 0 scores, shifted
+// by their maximum so that log() is called once. As in logsumexp()
+// above, the scores below the maximum by more than MINUS_LOG_EPSILON
+// are ignored. If |fast| is true, exp() is replaced by a polynomial
+// with a relative error below 1e-8, run on four scores at a time with
+// AVX2; the result does not depend on whether AVX2 is available.
+double logsumexp(const double *x, size_t size, bool fast);
+
 inline short int tocost(double d, int n) {
   static const short max = +32767;
   static const short min = -32767;
@@ -9,6 +9,7 @@
 #include <cstring>
 #include "common.h"
 #include "connector.h"
+#include "dictionary.h"
 #include "mecab.h"
 #include "nbest_generator.h"
 #include "param.h"
@@ -17,41 +18,62 @@
 #include "string_buffer.h"
 #include "tokenizer.h"
 
+#ifdef MECAB_USE_AVX2
+#include <immintrin.h>
+#endif
+
 namespace MeCab {
 
 namespace {
-void calc_alpha(Node *n, double beta) {
-  n->alpha = 0.0;
+// beam width used when MECAB_BEAM is requested without --beam.
+const size_t kDefaultBeamSize = 32;
+
+// The scores of the paths are gathered into |score| and summed by the
+// batched logsumexp(). exp() is approximated if |fast_exp| is true.
+double sum_scores(const std::vector<double> &score, bool fast_exp) {
+  return score.empty() ? 0.0 :
+      logsumexp(&score[0], score.size(), fast_exp);
+}
+
+void calc_alpha(Node *n, double beta, std::vector<double> *score,
+                bool fast_exp) {
+  score->clear();
   for (Path *path = n->lpath; path; path = path->lnext) {
-    n->alpha = logsumexp(n->alpha,
-                         -beta * path->cost + path->lnode->alpha,
-                         path == n->lpath);
+    score->push_back(-beta * path->cost + path->lnode->alpha);
   }
+  n->alpha = sum_scores(*score, fast_exp);
 }
 
-void calc_beta(Node *n, double beta) {
-  n->beta = 0.0;
+void calc_beta(Node *n, double beta, std::vector<double> *score,
+               bool fast_exp) {
+  score->clear();
   for (Path *path = n->rpath; path; path = path->rnext) {
-    n->beta = logsumexp(n->beta,
-                        -beta * path->cost + path->rnode->beta,
-                        path == n->rpath);
+    score->push_back(-beta * path->cost + path->rnode->beta);
   }
+  n->beta = sum_scores(*score, fast_exp);
 }
 }  // namespace
 
 Viterbi::Viterbi()
     :  tokenizer_(0), connector_(0),
-       cost_factor_(0) {}
+       cost_factor_(0), beam_size_(0), fast_exp_(false) {}
 
 Viterbi::~Viterbi() {}
 
 bool Viterbi::open(const Param &param) {
+  const std::string dicdir = param.get<std::string>("dicdir");
+  if (is_regular_file(dicdir.c_str())) {
+    bundle_.reset(new Bundle);
+    CHECK_FALSE(bundle_->open(dicdir.c_str(), dictionary_mode(param).c_str()))
+        << bundle_->what();
+  }
+
   tokenizer_.reset(new Tokenizer<Node, Path>);
-  CHECK_FALSE(tokenizer_->open(param)) << tokenizer_->what();
+  CHECK_FALSE(tokenizer_->open(param, bundle_.get())) << tokenizer_->what();
   CHECK_FALSE(tokenizer_->dictionary_info()) << "Dictionary is empty";
 
   connector_.reset(new Connector);
-  CHECK_FALSE(connector_->open(param)) << connector_->what();
+  CHECK_FALSE(connector_->open(param, bundle_.get())) << connector_->what();
 
   CHECK_FALSE(tokenizer_->dictionary_info()->lsize ==
               connector_->left_size() &&
@@ -64,10 +86,19 @@ bool Viterbi::open(const Param &param) {
     cost_factor_ = 800;
   }
 
+  const int beam_size = param.get<int>("beam");
+  beam_size_ = beam_size > 0 ? beam_size : kDefaultBeamSize;
+
+  fast_exp_ = param.get<bool>("fast-exp");
+
   return true;
 }
 
 bool Viterbi::analyze(Lattice *lattice) const {
+  return analyze(lattice, 0);
+}
+
+bool Viterbi::analyze(Lattice *lattice, const Node *left_context) const {
   if (!lattice || !lattice->sentence()) {
     return false;
   }
@@ -78,19 +109,20 @@ bool Viterbi::analyze(Lattice *lattice) const {
 
   bool result = false;
   if (lattice->has_request_type(MECAB_NBEST) ||
-      lattice->has_request_type(MECAB_MARGINAL_PROB)) {
+      (lattice->has_request_type(MECAB_MARGINAL_PROB) &&
+       !lattice->has_request_type(MECAB_MARGINAL_WITHOUT_PATH))) {
     // IsAllPath=true
     if (lattice->has_constraint()) {
-      result = viterbi<true, true>(lattice);
+      result = viterbi<true, true>(lattice, left_context);
     } else {
-      result = viterbi<true, false>(lattice);
+      result = viterbi<true, false>(lattice, left_context);
     }
   } else {
     // IsAllPath=false
     if (lattice->has_constraint()) {
-      result = viterbi<false, true>(lattice);
+      result = viterbi<false, true>(lattice, left_context);
     } else {
-      result = viterbi<false, false>(lattice);
+      result = viterbi<false, false>(lattice, left_context);
     }
   }
 
@@ -125,14 +157,19 @@ const Connector *Viterbi::connector() const {
   return connector_.get();
 }
 
-// static
-bool Viterbi::forwardbackward(Lattice *lattice) {
+bool Viterbi::forwardbackward(Lattice *lattice) const {
   if (!lattice->has_request_type(MECAB_MARGINAL_PROB)) {
     return true;
   }
 
+  if (lattice->has_request_type(MECAB_MARGINAL_WITHOUT_PATH) &&
+      !lattice->has_request_type(MECAB_NBEST)) {
+    return forwardbackwardWithoutPath(lattice);
+  }
+
   Node **end_node_list   = lattice->end_nodes();
   Node **begin_node_list = lattice->begin_nodes();
+  std::vector<double> *score = &lattice->allocator()->end_node_array()->score;
 
   const size_t len = lattice->size();
   const double theta = lattice->theta();
@@ -140,14 +177,14 @@ bool Viterbi::forwardbackward(Lattice *lattice) {
   end_node_list[0]->alpha = 0.0;
   for (int pos = 0; pos <= static_cast<long>(len); ++pos) {
     for (Node *node = begin_node_list[pos]; node; node = node->bnext) {
-      calc_alpha(node, theta);
+      calc_alpha(node, theta, score, fast_exp_);
     }
   }
 
   begin_node_list[len]->beta = 0.0;
   for (int pos = static_cast<long>(len); pos >= 0; --pos) {
     for (Node *node = end_node_list[pos]; node; node = node->enext) {
-      calc_beta(node, theta);
+      calc_beta(node, theta, score, fast_exp_);
     }
   }
 
@@ -168,6 +205,92 @@ bool Viterbi::forwardbackward(Lattice *lattice) {
   return true;
 }
 
+// The same as forwardbackward(), but the connection costs are taken
+// from the matrix instead of the paths, which were not made. The terms
+// are summed in the order of Node::lpath and rpath, i.e. the reverse
+// of the list order, so that the probabilities are exactly the same.
+bool Viterbi::forwardbackwardWithoutPath(Lattice *lattice) const {
+  Node **end_node_list   = lattice->end_nodes();
+  Node **begin_node_list = lattice->begin_nodes();
+  EndNodeArray<Node> *array = lattice->allocator()->end_node_array();
+  std::vector<Node *> &nodes = array->path_node;
+  std::vector<double> &score = array->score;
+
+  const size_t len = lattice->size();
+  const double theta = lattice->theta();
+  const Connector *connector = connector_.get();
+
+  // EOS is connected to the end nodes at the last position which
+  // has them, and is put first in that list.
+  Node *eos_node = begin_node_list[len];
+  const Node *last_node = eos_node->prev;
+  const size_t eos_pos = last_node->surface + last_node->length -
+      lattice->sentence();
+
+  end_node_list[0]->alpha = 0.0;
+  for (size_t pos = 0; pos <= len; ++pos) {
+    nodes.clear();
+    for (Node *lnode = end_node_list[pos]; lnode; lnode = lnode->enext) {
+      if (lnode != eos_node) {
+        nodes.push_back(lnode);
+      }
+    }
+    Node *rnode = pos == len ? 0 : begin_node_list[pos];
+    if (pos == eos_pos) {
+      eos_node->bnext = rnode;
+      rnode = eos_node;
+    }
+    for (; rnode; rnode = rnode->bnext) {
+      score.clear();
+      for (size_t i = nodes.size(); i > 0; --i) {
+        const Node *lnode = nodes[i - 1];
+        score.push_back(-theta * connector->cost(lnode, rnode)
+                        + lnode->alpha);
+      }
+      rnode->alpha = sum_scores(score, fast_exp_);
+    }
+    eos_node->bnext = 0;
+  }
+
+  eos_node->beta = 0.0;
+  for (long pos = static_cast<long>(len); pos >= 0; --pos) {
+    nodes.clear();
+    if (pos == static_cast<long>(eos_pos)) {
+      nodes.push_back(eos_node);
+    }
+    const size_t eos_size = nodes.size();
+    if (pos < static_cast<long>(len)) {
+      for (Node *rnode = begin_node_list[pos]; rnode; rnode = rnode->bnext) {
+        nodes.push_back(rnode);
+      }
+      std::reverse(nodes.begin() + eos_size, nodes.end());
+    }
+    for (Node *lnode = end_node_list[pos]; lnode; lnode = lnode->enext) {
+      if (lnode == eos_node) {
+        continue;
+      }
+      score.clear();
+      for (size_t i = 0; i < nodes.size(); ++i) {
+        const Node *rnode = nodes[i];
+        score.push_back(-theta * connector->cost(lnode, rnode)
+                        + rnode->beta);
+      }
+      lnode->beta = sum_scores(score, fast_exp_);
+    }
+  }
+
+  const double Z = eos_node->alpha;
+  lattice->set_Z(Z);  // alpha of EOS
+
+  for (size_t pos = 0; pos <= len; ++pos) {
+    for (Node *node = begin_node_list[pos]; node; node = node->bnext) {
+      node->prob = std::exp(node->alpha + node->beta - Z);
+    }
+  }
+
+  return true;
+}
+
 // static
 bool Viterbi::buildResultForNBest(Lattice *lattice) {
   return buildAllLattice(lattice);
@@ -312,11 +435,11 @@ bool Viterbi::initPartial(Lattice *lattice) {
 }
 
 namespace {
-template <bool IsAllPath> bool connect(size_t pos, Node *rnode,
-                                       Node **begin_node_list,
-                                       Node **end_node_list,
-                                       const Connector *connector,
-                                       Allocator<Node, Path> *allocator) {
+template <bool IsAllPath> bool connect_list(size_t pos, Node *rnode,
+                                            Node **begin_node_list,
+                                            Node **end_node_list,
+                                            const Connector *connector,
+                                            Allocator<Node, Path> *allocator) {
   for (;rnode; rnode = rnode->bnext) {
     register long best_cost = 2147483647;
     Node* best_node = 0;
@@ -356,23 +479,257 @@ template <bool IsAllPath> bool connect(size_t pos, Node *rnode,
 
   return true;
 }
+
+// 1-best connect() over end nodes gathered in EndNodeArray.
+//
+// The minimum of cost[i] + row[rcAttr[i]] is searched with 32-bit
+// relative costs, and the first (leftmost) minimum is taken as the
+// linked-list version does, so the results are exactly the same.
+// Arrays are padded to a multiple of kLanes with entries which never win.
+const size_t kLanes = 8;
+// Shorter end node lists are connected by walking the list, as the
+// gathering does not pay off for them.
+const size_t kMinGatherSize = 8;
+const int kMaxRelativeCost = 0x3fffffff;
+const int kPaddingCost = 0x40010000;
+
+typedef size_t (*ConnectMinFunc)(const short *row, const int *rcAttr,
+                                 const int *cost, size_t size,
+                                 int *min_cost);
+
+size_t connect_min_scalar(const short *row, const int *rcAttr,
+                          const int *cost, size_t size, int *min_cost) {
+  size_t best = 0;
+  int best_cost = cost[0] + row[rcAttr[0]];
+  for (size_t i = 1; i < size; ++i) {
+    const int c = cost[i] + row[rcAttr[i]];
+    if (c < best_cost) {
+      best = i;
+      best_cost = c;
+    }
+  }
+  *min_cost = best_cost;
+  return best;
+}
+
+#ifdef MECAB_USE_AVX2
+// Eight matrix entries are fetched by one 32-bit gather from row - 1,
+// so that row[rcAttr] lands in the upper half of each lane and is
+// sign-extended by the arithmetic shift.
+__attribute__((target("avx2")))
+size_t connect_min_avx2(const short *row, const int *rcAttr,
+                        const int *cost, size_t size, int *min_cost) {
+  const int *base = reinterpret_cast<const int *>(row - 1);
+  __m256i vmin = _mm256_set1_epi32(2147483647);
+  __m256i vbest = _mm256_setzero_si256();
+  __m256i vidx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i vstep = _mm256_set1_epi32(kLanes);
+  for (size_t i = 0; i < size; i += kLanes) {
+    const __m256i rc = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(rcAttr + i));
+    const __m256i m = _mm256_srai_epi32(
+        _mm256_i32gather_epi32(base, rc, 2), 16);
+    const __m256i c = _mm256_add_epi32(
+        m, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(cost + i)));
+    const __m256i lt = _mm256_cmpgt_epi32(vmin, c);
+    vmin  = _mm256_blendv_epi8(vmin, c, lt);
+    vbest = _mm256_blendv_epi8(vbest, vidx, lt);
+    vidx  = _mm256_add_epi32(vidx, vstep);
+  }
+
+  int lane_min[kLanes];
+  int lane_best[kLanes];
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(lane_min), vmin);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(lane_best), vbest);
+  size_t best = lane_best[0];
+  int best_cost = lane_min[0];
+  for (size_t i = 1; i < kLanes; ++i) {
+    if (lane_min[i] < best_cost ||
+        (lane_min[i] == best_cost &&
+         static_cast<size_t>(lane_best[i]) < best)) {
+      best = lane_best[i];
+      best_cost = lane_min[i];
+    }
+  }
+  *min_cost = best_cost;
+  return best;
+}
+#endif
+
+ConnectMinFunc select_connect_min() {
+#ifdef MECAB_USE_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return &connect_min_avx2;
+  }
+#endif
+  return &connect_min_scalar;
+}
+
+const ConnectMinFunc connect_min = select_connect_min();
+
+// true if the end node list from |lnode| has at least |size| nodes.
+bool has_nodes(const Node *lnode, size_t size) {
+  for (; lnode && size > 0; lnode = lnode->enext) {
+    --size;
+  }
+  return size == 0;
+}
+
+// Keeps the |beam_size| best end nodes in the list |*lnode| and unlinks
+// the others. The list order is preserved, and the earlier nodes win
+// the ties at the border, as connect() prefers them as well.
+void prune_end_nodes(Node **lnode, size_t beam_size,
+                     EndNodeArray<Node> *array) {
+  if (!has_nodes(*lnode, beam_size + 1)) {
+    return;
+  }
+
+  std::vector<long> &cost = array->beam_cost;
+  cost.clear();
+  for (const Node *node = *lnode; node; node = node->enext) {
+    cost.push_back(node->cost);
+  }
+  std::nth_element(cost.begin(), cost.begin() + beam_size - 1, cost.end());
+  const long threshold = cost[beam_size - 1];
+  size_t ties = beam_size;
+  for (size_t i = 0; i < beam_size; ++i) {
+    if (cost[i] < threshold) {
+      --ties;
+    }
+  }
+
+  Node **tail = lnode;
+  for (Node *node = *lnode; node;) {
+    Node *next = node->enext;
+    if (node->cost < threshold || (node->cost == threshold && ties > 0)) {
+      if (node->cost == threshold) {
+        --ties;
+      }
+      *tail = node;
+      tail = &node->enext;
+    }
+    node = next;
+  }
+  *tail = 0;
+}
+
+// Gathers the end nodes from |lnode| into |array|. Returns false if
+// there are fewer than kMinGatherSize of them, or their costs are too
+// far apart to be represented as 32-bit relative costs.
+//
+// A node is read once: its rcAttr and cost are copied with the pointer,
+// and the costs are made relative in the gathered array.
+bool gather_end_nodes(Node *lnode, EndNodeArray<Node> *array) {
+  std::vector<Node *> &node = array->node;
+  std::vector<long> &node_cost = array->node_cost;
+  size_t size = 0;
+  long min_cost = lnode->cost;
+  long max_cost = lnode->cost;
+  for (; lnode; lnode = lnode->enext) {
+    if (size == node.size()) {
+      const size_t new_size = 2 * size + kLanes;
+      node.resize(new_size);
+      node_cost.resize(new_size);
+      array->rcAttr.resize(new_size);
+      array->cost.resize(new_size);
+    }
+    const long cost = lnode->cost;
+    node[size] = lnode;
+    node_cost[size] = cost;
+    array->rcAttr[size] = lnode->rcAttr;
+    ++size;
+    min_cost = std::min(min_cost, cost);
+    max_cost = std::max(max_cost, cost);
+  }
+
+  if (size < kMinGatherSize || max_cost - min_cost > kMaxRelativeCost) {
+    return false;
+  }
+
+  const size_t padded_size = (size + kLanes - 1) / kLanes * kLanes;
+  for (size_t i = 0; i < size; ++i) {
+    array->cost[i] = static_cast<int>(node_cost[i] - min_cost);
+  }
+  for (size_t i = size; i < padded_size; ++i) {
+    array->rcAttr[i] = 0;
+    array->cost[i] = kPaddingCost;
+  }
+  array->base = min_cost;
+  array->size = padded_size;
+
+  return true;
+}
+
+bool connect_best(size_t pos, Node *rnode,
+                  Node **end_node_list,
+                  const Connector *connector,
+                  const EndNodeArray<Node> &array) {
+  for (;rnode; rnode = rnode->bnext) {
+    int min_cost = 0;
+    const size_t best = connect_min(connector->row(rnode->lcAttr),
+                                    &array.rcAttr[0], &array.cost[0],
+                                    array.size, &min_cost);
+    const long best_cost = array.base + min_cost + rnode->wcost;
+
+    // overflow check 2003/03/09
+    if (best_cost >= 2147483647) {
+      return false;
+    }
+
+    rnode->prev = array.node[best];
+    rnode->next = 0;
+    rnode->cost = best_cost;
+    const size_t x = rnode->rlength + pos;
+    rnode->enext = end_node_list[x];
+    end_node_list[x] = rnode;
+  }
+
+  return true;
+}
+
+template <bool IsAllPath> bool connect(size_t pos, Node *rnode,
+                                       Node **begin_node_list,
+                                       Node **end_node_list,
+                                       const Connector *connector,
+                                       Allocator<Node, Path> *allocator) {
+  // a compressed matrix has no rows to gather the costs from.
+  if (!IsAllPath && !connector->is_compressed()) {
+    EndNodeArray<Node> *array = allocator->end_node_array();
+    if (gather_end_nodes(end_node_list[pos], array)) {
+      return connect_best(pos, rnode, end_node_list, connector, *array);
+    }
+  }
+  return connect_list<IsAllPath>(pos, rnode, begin_node_list,
+                                 end_node_list, connector, allocator);
+}
 }  // namespace
 
 template <bool IsAllPath, bool IsPartial>
-bool Viterbi::viterbi(Lattice *lattice) const {
+bool Viterbi::viterbi(Lattice *lattice, const Node *left_context) const {
   Node **end_node_list   = lattice->end_nodes();
   Node **begin_node_list = lattice->begin_nodes();
   Allocator<Node, Path> *allocator = lattice->allocator();
   const size_t len = lattice->size();
   const char *begin = lattice->sentence();
   const char *end = begin + len;
+  const size_t beam_size =
+      (!IsAllPath && lattice->has_request_type(MECAB_BEAM) &&
+       !lattice->has_request_type(MECAB_MARGINAL_PROB)) ? beam_size_ : 0;
 
   Node *bos_node = tokenizer_->getBOSNode(lattice->allocator());
   bos_node->surface = lattice->sentence();
+  if (left_context) {
+    bos_node->rcAttr = left_context->rcAttr;
+  }
   end_node_list[0] = bos_node;
 
   for (size_t pos = 0; pos < len; ++pos) {
     if (end_node_list[pos]) {
+      if (beam_size) {
+        prune_end_nodes(&end_node_list[pos], beam_size,
+                        allocator->end_node_array());
+      }
       Node *right_node = tokenizer_->lookup<IsPartial>(begin + pos, end,
                                                        allocator, lattice);
       begin_node_list[pos] = right_node;
@@ -393,6 +750,10 @@ bool Viterbi::viterbi(Lattice *lattice) const {
 
   for (long pos = len; static_cast<long>(pos) >= 0; --pos) {
     if (end_node_list[pos]) {
+      if (beam_size) {
+        prune_end_nodes(&end_node_list[pos], beam_size,
+                        allocator->end_node_array());
+      }
       if (!connect<IsAllPath>(pos, eos_node,
                               begin_node_list,
                               end_node_list,
@@ -15,6 +15,7 @@ namespace MeCab {
 class Lattice;
 class Param;
 class Connector;
+class Bundle;
 template <typename N, typename P> class Tokenizer;
 
 class Viterbi {
@@ -23,10 +24,19 @@ class Viterbi {
 
   bool analyze(Lattice *lattice) const;
 
+  // Analyzes |lattice| as the continuation of a sentence whose
+  // preceding morpheme is |left_context|. The BOS node takes over its
+  // right context id, so that the best path is the one of the whole
+  // sentence.
+  bool analyze(Lattice *lattice, const Node *left_context) const;
+
   const Tokenizer<Node, Path> *tokenizer() const;
 
   const Connector *connector() const;
 
+  // the bundle the dictionaries are read from, or NULL.
+  const Bundle *bundle() const { return bundle_.get(); }
+
   const char *what() { return what_.str(); }
 
   static bool buildResultForNBest(Lattice *lattice);
@@ -35,18 +45,25 @@ class Viterbi {
   virtual ~Viterbi();
 
  private:
-  template <bool IsAllPath, bool IsPartial> bool viterbi(Lattice *lattice) const;
+  template <bool IsAllPath, bool IsPartial>
+  bool viterbi(Lattice *lattice, const Node *left_context) const;
 
-  static bool forwardbackward(Lattice *lattice);
+  bool forwardbackward(Lattice *lattice) const;
+  bool forwardbackwardWithoutPath(Lattice *lattice) const;
   static bool initPartial(Lattice *lattice);
   static bool initNBest(Lattice *lattice);
   static bool buildBestLattice(Lattice *lattice);
   static bool buildAllLattice(Lattice *lattice);
   static bool buildAlternative(Lattice *lattice);
 
+  // the dictionary bundle given as dicdir. It is declared first, since
+  // the tokenizer and the connector point into it.
+  scoped_ptr<Bundle> bundle_;
   scoped_ptr<Tokenizer<Node, Path> > tokenizer_;
   scoped_ptr<Connector> connector_;
   int                   cost_factor_;
+  size_t                beam_size_;
+  bool                  fast_exp_;
   whatlog               what_;
 };
 }
@@ -10,12 +10,13 @@
 #include "common.h"
 #include "param.h"
 #include "string_buffer.h"
+#include "tokenizer.h"
 #include "utils.h"
 #include "writer.h"
 
 namespace MeCab {
 
-Writer::Writer() : write_(&Writer::writeLattice) {}
+Writer::Writer() : tokenizer_(0), write_(&Writer::writeLattice) {}
 Writer::~Writer() {}
 
 void Writer::close() {
@@ -96,17 +97,38 @@ bool Writer::open(const Param &param) {
       if (eon_format != eon_format2) {
         eon_format = eon_format2;
       }
-      node_format_.reset_string(node_format.c_str());
-      bos_format_.reset_string(bos_format.c_str());
-      eos_format_.reset_string(eos_format.c_str());
-      unk_format_.reset_string(unk_format.c_str());
-      eon_format_.reset_string(eon_format.c_str());
+      node_format_.compile(node_format.c_str());
+      bos_format_.compile(bos_format.c_str());
+      eos_format_.compile(eos_format.c_str());
+      unk_format_.compile(unk_format.c_str());
+      eon_format_.compile(eon_format.c_str());
     }
   }
 
   return true;
 }
 
+bool NodeFormat::has_paths() const {
+  for (size_t i = 0; i < ops_.size(); ++i) {
+    if (ops_[i].type == OP_PATHS) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool NodeFormat::is_streamable() const {
+  for (size_t i = 0; i < ops_.size(); ++i) {
+    switch (ops_[i].type) {
+      case OP_SENTENCE: case OP_SENTENCE_LENGTH: case OP_BEGIN_POS:
+      case OP_END_POS: case OP_ID: case OP_PATHS: case OP_CONNECTION_COST:
+      case OP_COST: case OP_NODE_COST:
+        return false;
+    }
+  }
+  return true;
+}
+
 bool Writer::write(Lattice *lattice, StringBuffer *os) const {
   if (!lattice || !lattice->is_available()) {
     return false;
@@ -114,6 +136,48 @@ bool Writer::write(Lattice *lattice, StringBuffer *os) const {
   return (this->*write_)(lattice, os);
 }
 
+bool Writer::writeBOS(Lattice *lattice, StringBuffer *os) const {
+  if (write_ == &Writer::writeUser) {
+    FeatureColumns columns(tokenizer_);
+    return bos_format_.write(lattice, lattice->bos_node(), os, &columns);
+  }
+  return true;
+}
+
+bool Writer::writeNodes(Lattice *lattice, const Node *begin, const Node *end,
+                        StringBuffer *os) const {
+  FeatureColumns columns(tokenizer_);
+  for (const Node *node = begin; node != end; node = node->next) {
+    if (write_ == &Writer::writeLattice) {
+      os->write(node->surface, node->length);
+      *os << '\t' << node->feature << '\n';
+    } else if (write_ == &Writer::writeWakati) {
+      os->write(node->surface, node->length);
+      *os << ' ';
+    } else if (write_ == &Writer::writeUser) {
+      const NodeFormat &fmt = (node->stat == MECAB_UNK_NODE ? unk_format_ :
+                               node_format_);
+      if (!fmt.write(lattice, node, os, &columns)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool Writer::writeEOS(Lattice *lattice, const Node *eos,
+                      StringBuffer *os) const {
+  if (write_ == &Writer::writeLattice) {
+    *os << "EOS\n";
+  } else if (write_ == &Writer::writeWakati) {
+    *os << '\n';
+  } else if (write_ == &Writer::writeUser) {
+    FeatureColumns columns(tokenizer_);
+    return eos_format_.write(lattice, eos, os, &columns);
+  }
+  return true;
+}
+
 bool Writer::writeLattice(Lattice *lattice, StringBuffer *os) const {
   for (const Node *node = lattice->bos_node()->next;
        node->next; node = node->next) {
@@ -199,18 +263,19 @@ bool Writer::writeDump(Lattice *lattice, StringBuffer *os) const {
 }
 
 bool Writer::writeUser(Lattice *lattice, StringBuffer *os) const {
-  if (!writeNode(lattice, bos_format_.get(), lattice->bos_node(), os)) {
+  FeatureColumns columns(tokenizer_);
+  if (!bos_format_.write(lattice, lattice->bos_node(), os, &columns)) {
     return false;
   }
   const Node *node = 0;
   for (node = lattice->bos_node()->next; node->next; node = node->next) {
-    const char *fmt = (node->stat == MECAB_UNK_NODE ? unk_format_.get() :
-                       node_format_.get());
-    if (!writeNode(lattice, fmt, node, os)) {
+    const NodeFormat &fmt = (node->stat == MECAB_UNK_NODE ? unk_format_ :
+                             node_format_);
+    if (!fmt.write(lattice, node, os, &columns)) {
       return false;
     }
   }
-  if (!writeNode(lattice, eos_format_.get(), node, os)) {
+  if (!eos_format_.write(lattice, node, os, &columns)) {
     return false;
   }
   return true;
@@ -218,187 +283,213 @@ bool Writer::writeUser(Lattice *lattice, StringBuffer *os) const {
 
 bool Writer::writeNode(Lattice *lattice, const Node *node,
                        StringBuffer *os) const {
+  FeatureColumns columns(tokenizer_);
   switch (node->stat) {
     case MECAB_BOS_NODE:
-      return writeNode(lattice, bos_format_.get(), node, os);
+      return bos_format_.write(lattice, node, os, &columns);
     case MECAB_EOS_NODE:
-      return writeNode(lattice, eos_format_.get(), node, os);
+      return eos_format_.write(lattice, node, os, &columns);
     case MECAB_UNK_NODE:
-      return writeNode(lattice, unk_format_.get(), node, os);
+      return unk_format_.write(lattice, node, os, &columns);
     case MECAB_NOR_NODE:
-      return writeNode(lattice, node_format_.get(), node, os);
+      return node_format_.write(lattice, node, os, &columns);
     case MECAB_EON_NODE:
-      return writeNode(lattice, eon_format_.get(), node, os);
+      return eon_format_.write(lattice, node, os, &columns);
   }
   return true;
 }
 
 bool Writer::writeNode(Lattice *lattice,
-                       const char *p,
+                       const char *format,
                        const Node *node,
                        StringBuffer *os) const {
-  scoped_fixed_array<char, BUF_SIZE> buf;
-  scoped_fixed_array<char *, 64> ptr;
-  size_t psize = 0;
+  NodeFormat fmt;
+  fmt.compile(format);
+  FeatureColumns columns(tokenizer_);
+  return fmt.write(lattice, node, os, &columns);
+}
+
+size_t FeatureColumns::split(const Node *node) {
+  if (node_ == node) {
+    return size_;
+  }
+  node_ = node;
+
+  const char *feature = node->feature;
+  const Dictionary *dic = tokenizer_ ?
+      tokenizer_->feature_dictionary(feature) : 0;
+  const unsigned short *ends = 0;
+  size_ = dic ? dic->feature_columns(feature, &ends) : 0;
+  if (size_) {
+    size_t begin = 0;
+    for (size_t i = 0; i < size_; ++i) {
+      column_[i] = feature + begin;
+      length_[i] = ends[i] - begin;
+      begin = ends[i] + 1;
+    }
+    return size_;
+  }
+
+  if (!buf_.get()) {
+    buf_.reset(new char[BUF_SIZE]);
+  }
+  char *ptr[kMaxColumns];
+  std::strncpy(buf_.get(), feature, BUF_SIZE);
+  size_ = tokenizeCSV(buf_.get(), ptr, kMaxColumns);
+  for (size_t i = 0; i < size_; ++i) {
+    column_[i] = ptr[i];
+    length_[i] = std::strlen(ptr[i]);
+  }
+  return size_;
+}
+
+NodeFormat::Op *NodeFormat::add_op(int type, std::string *literal) {
+  if (!literal->empty()) {
+    ops_.push_back(Op(OP_LITERAL));
+    ops_.back().str.swap(*literal);
+    literal->clear();
+  }
+  if (type != OP_LITERAL) {
+    ops_.push_back(Op(type));
+  }
+  return &ops_.back();
+}
+
+void NodeFormat::add_error(const std::string &message,
+                           std::string *literal) {
+  add_op(OP_ERROR, literal)->str = message;
+}
+
+void NodeFormat::compile(const char *p) {
+  ops_.clear();
+  std::string literal;
 
   for (; *p; p++) {
     switch (*p) {
-      default: *os << *p; break;
+      default: literal += *p; break;
 
-      case '\\': *os << getEscapedChar(*++p); break;
+      case '\\':
+        literal += getEscapedChar(*++p);
+        if (!*p) {
+          add_op(OP_LITERAL, &literal);
+          return;
+        }
+        break;
 
       case '%': {  // macros
         switch (*++p) {
-          default: {
-            const std::string error = "unknown meta char: " + *p;
-            lattice->set_what(error.c_str());
-            return false;
-          }
+          default:
+            add_error(std::string("unknown meta char: ") + *p, &literal);
+            return;
             // input sentence
-          case 'S': os->write(lattice->sentence(), lattice->size()); break;
+          case 'S': add_op(OP_SENTENCE, &literal); break;
             // sentence length
-          case 'L': *os << lattice->size(); break;
+          case 'L': add_op(OP_SENTENCE_LENGTH, &literal); break;
             // morph
-          case 'm': os->write(node->surface, node->length); break;
-          case 'M': os->write(reinterpret_cast<const char *>
-                              (node->surface - node->rlength + node->length),
-                              node->rlength);
-            break;
-          case 'h': *os << node->posid; break;  // Part-Of-Speech ID
-          case '%': *os << '%'; break;         // %
-          case 'c': *os << static_cast<int>(node->wcost); break;  // word cost
-          case 'H': *os << node->feature; break;
-          case 't': *os << static_cast<unsigned int>(node->char_type); break;
-          case 's': *os << static_cast<unsigned int>(node->stat); break;
-          case 'P': *os << node->prob; break;
+          case 'm': add_op(OP_SURFACE, &literal); break;
+          case 'M': add_op(OP_SURFACE_WITH_SPACE, &literal); break;
+          case 'h': add_op(OP_POSID, &literal); break;  // Part-Of-Speech ID
+          case '%': literal += '%'; break;              // %
+          case 'c': add_op(OP_WCOST, &literal); break;  // word cost
+          case 'H': add_op(OP_FEATURE, &literal); break;
+          case 't': add_op(OP_CHAR_TYPE, &literal); break;
+          case 's': add_op(OP_STAT, &literal); break;
+          case 'P': add_op(OP_PROB, &literal); break;
           case 'p': {
             switch (*++p) {
               default:
-                lattice->set_what("[iseSCwcnblLh] is required after %p");
-                return false;
-              case 'i': *os << node->id; break;  // node id
-              case 'S': os->write(reinterpret_cast<const char*>
-                                  (node->surface -
-                                   node->rlength + node->length),
-                                  node->rlength - node->length);
-                break;  // space
+                add_error("[iseSCwcnblLh] is required after %p", &literal);
+                return;
+              case 'i': add_op(OP_ID, &literal); break;  // node id
+              case 'S': add_op(OP_SPACE, &literal); break;  // space
                 // start position
-              case 's': *os << static_cast<int>(
-                  node->surface - lattice->sentence());
-                break;
+              case 's': add_op(OP_BEGIN_POS, &literal); break;
                 // end position
-              case 'e': *os << static_cast<int>
-                    (node->surface - lattice->sentence() + node->length);
-                break;
+              case 'e': add_op(OP_END_POS, &literal); break;
                 // connection cost
-              case 'C': *os << node->cost -
-                    node->prev->cost - node->wcost;
-                break;
-              case 'w': *os << node->wcost; break;  // word cost
-              case 'c': *os << node->cost; break;  // best cost
-              case 'n': *os << (node->cost - node->prev->cost); break;
+              case 'C': add_op(OP_CONNECTION_COST, &literal); break;
+              case 'w': add_op(OP_WCOST, &literal); break;  // word cost
+              case 'c': add_op(OP_COST, &literal); break;  // best cost
+              case 'n': add_op(OP_NODE_COST, &literal); break;
                 // node cost
                 // * if best path, otherwise ' '
-              case 'b': *os << (node->isbest ? '*' : ' '); break;
-              case 'P': *os << node->prob; break;
-              case 'A': *os << node->alpha; break;
-              case 'B': *os << node->beta; break;
-              case 'l': *os << node->length; break;  // length of morph
+              case 'b': add_op(OP_ISBEST, &literal); break;
+              case 'P': add_op(OP_PROB, &literal); break;
+              case 'A': add_op(OP_ALPHA, &literal); break;
+              case 'B': add_op(OP_BETA, &literal); break;
+                // length of morph
+              case 'l': add_op(OP_LENGTH, &literal); break;
                 // length of morph including the spaces
-              case 'L': *os << node->rlength;    break;
+              case 'L': add_op(OP_RLENGTH, &literal); break;
               case 'h': {  // Hidden Layer ID
                 switch (*++p) {
                   default:
-                    lattice->set_what("lr is required after %ph");
-                    return false;
-                  case 'l': *os << node->lcAttr; break;   // current
-                  case 'r': *os << node->rcAttr; break;   // prev
+                    add_error("lr is required after %ph", &literal);
+                    return;
+                  case 'l': add_op(OP_LCATTR, &literal); break;  // current
+                  case 'r': add_op(OP_RCATTR, &literal); break;  // prev
                 }
               } break;
 
               case 'p': {
-                char mode = *++p;
-                char sep = *++p;
-                if (sep == '\\') {
-                  sep = getEscapedChar(*++p);
+                // the mode is checked when the node is written, since
+                // "no path information" takes precedence.
+                Op *op = add_op(OP_PATHS, &literal);
+                op->mode = *++p;
+                if (!op->mode || !*++p) {
+                  return;
                 }
-                if (!node->lpath) {
-                  lattice->set_what("no path information is available");
-                  return false;
-                }
-                for (Path *path = node->lpath; path; path = path->lnext) {
-                  if (path != node->lpath) *os << sep;
-                  switch (mode) {
-                    case 'i': *os << path->lnode->id; break;
-                    case 'c': *os << path->cost; break;
-                    case 'P': *os << path->prob; break;
-                    default:
-                      lattice->set_what("[icP] is required after %pp");
-                      return false;
+                op->separator = *p;
+                if (op->separator == '\\') {
+                  op->separator = getEscapedChar(*++p);
+                  if (!*p) {
+                    return;
                   }
                 }
               } break;
-
             }
           } break;
 
           case 'F':
           case 'f': {
-            if (node->feature[0] == '\0') {
-              lattice->set_what("no feature information available");
-              return false;
-            }
-            if (!psize) {
-              std::strncpy(buf.get(), node->feature, buf.size());
-              psize = tokenizeCSV(buf.get(), ptr.get(), ptr.size());
-            }
-
-            // separator
-            char separator = '\t';  // default separator
+            // errors are kept in |op->str|, since "no feature information"
+            // and an out-of-range index take precedence over them.
+            Op *op = add_op(OP_COLUMNS, &literal);
+            op->separator = '\t';  // default separator
             if (*p == 'F') {  // change separator
               if (*++p == '\\') {
-                separator = getEscapedChar(*++p);
+                op->separator = getEscapedChar(*++p);
               } else {
-                separator = *p;
+                op->separator = *p;
+              }
+              if (!*p) {
+                op->str = "cannot find '['";
+                return;
               }
             }
 
-            if (*++p !='[') {
-              lattice->set_what("cannot find '['");
-              return false;
+            if (*++p != '[') {
+              op->str = "cannot find '['";
+              return;
             }
-            size_t n = 0;
-            bool sep = false;
-            bool isfil = false;
-            p++;
 
-            for (;; ++p) {
+            size_t n = 0;
+            for (++p;; ++p) {
               switch (*p) {
                 case '0': case '1': case '2': case '3': case '4':
                 case '5': case '6': case '7': case '8': case '9':
                   n = 10 * n +(*p - '0');
                   break;
                 case ',': case ']':
-                  if (n >= psize) {
-                    lattice->set_what("given index is out of range");
-                    return false;
-                  }
-                  isfil = (ptr[n][0] != '*');
-                  if (isfil) {
-                    if (sep) {
-                      *os << separator;
-                    }
-                    *os << ptr[n];
-                  }
+                  op->columns.push_back(n);
                   if (*p == ']') {
                     goto last;
                   }
-                  sep = isfil;
                   n = 0;
                   break;
                 default:
-                  lattice->set_what("cannot find ']'");
-                  return false;
+                  op->str = "cannot find ']'";
+                  return;
               }
             }
           } last: break;
@@ -407,6 +498,115 @@ bool Writer::writeNode(Lattice *lattice,
     }  // end switch
   }
 
+  add_op(OP_LITERAL, &literal);
+}
+
+bool NodeFormat::write(Lattice *lattice,
+                       const Node *node,
+                       StringBuffer *os,
+                       FeatureColumns *columns) const {
+  for (std::vector<Op>::const_iterator op = ops_.begin();
+       op != ops_.end(); ++op) {
+    switch (op->type) {
+      case OP_LITERAL: os->write(op->str.data(), op->str.size()); break;
+      case OP_SENTENCE:
+        os->write(lattice->sentence(), lattice->size());
+        break;
+      case OP_SENTENCE_LENGTH: *os << lattice->size(); break;
+      case OP_SURFACE: os->write(node->surface, node->length); break;
+      case OP_SURFACE_WITH_SPACE:
+        os->write(reinterpret_cast<const char *>
+                  (node->surface - node->rlength + node->length),
+                  node->rlength);
+        break;
+      case OP_POSID: *os << node->posid; break;
+      case OP_WCOST: *os << static_cast<int>(node->wcost); break;
+      case OP_FEATURE: *os << node->feature; break;
+      case OP_CHAR_TYPE:
+        *os << static_cast<unsigned int>(node->char_type);
+        break;
+      case OP_STAT: *os << static_cast<unsigned int>(node->stat); break;
+      case OP_PROB: *os << node->prob; break;
+      case OP_ID: *os << node->id; break;
+      case OP_SPACE:
+        os->write(reinterpret_cast<const char*>
+                  (node->surface - node->rlength + node->length),
+                  node->rlength - node->length);
+        break;
+      case OP_BEGIN_POS:
+        *os << static_cast<int>(node->surface - lattice->sentence());
+        break;
+      case OP_END_POS:
+        *os << static_cast<int>
+            (node->surface - lattice->sentence() + node->length);
+        break;
+      case OP_CONNECTION_COST:
+        *os << node->cost - node->prev->cost - node->wcost;
+        break;
+      case OP_COST: *os << node->cost; break;
+      case OP_NODE_COST: *os << (node->cost - node->prev->cost); break;
+      case OP_ISBEST: *os << (node->isbest ? '*' : ' '); break;
+      case OP_ALPHA: *os << node->alpha; break;
+      case OP_BETA: *os << node->beta; break;
+      case OP_LENGTH: *os << node->length; break;
+      case OP_RLENGTH: *os << node->rlength; break;
+      case OP_LCATTR: *os << node->lcAttr; break;
+      case OP_RCATTR: *os << node->rcAttr; break;
+
+      case OP_PATHS: {
+        if (!node->lpath) {
+          lattice->set_what("no path information is available");
+          return false;
+        }
+        for (Path *path = node->lpath; path; path = path->lnext) {
+          if (path != node->lpath) *os << op->separator;
+          switch (op->mode) {
+            case 'i': *os << path->lnode->id; break;
+            case 'c': *os << path->cost; break;
+            case 'P': *os << path->prob; break;
+            default:
+              lattice->set_what("[icP] is required after %pp");
+              return false;
+          }
+        }
+      } break;
+
+      case OP_COLUMNS: {
+        if (node->feature[0] == '\0') {
+          lattice->set_what("no feature information available");
+          return false;
+        }
+        const size_t psize = columns->split(node);
+        bool sep = false;
+        for (size_t i = 0; i < op->columns.size(); ++i) {
+          const size_t n = op->columns[i];
+          if (n >= psize) {
+            lattice->set_what("given index is out of range");
+            return false;
+          }
+          size_t length = 0;
+          const char *column = columns->column(n, &length);
+          const bool isfil = (length == 0 || column[0] != '*');
+          if (isfil) {
+            if (sep) {
+              *os << op->separator;
+            }
+            os->write(column, length);
+          }
+          sep = isfil;
+        }
+        if (!op->str.empty()) {
+          lattice->set_what(op->str.c_str());
+          return false;
+        }
+      } break;
+
+      case OP_ERROR:
+        lattice->set_what(op->str.c_str());
+        return false;
+    }
+  }
+
   return true;
 }
 }
@@ -7,6 +7,7 @@
 #define MECAB_WRITER_H_
 
 #include <string>
+#include <vector>
 #include "common.h"
 #include "mecab.h"
 #include "utils.h"
@@ -17,6 +18,79 @@ namespace MeCab {
 
 class Param;
 
+template <typename N, typename P> class Tokenizer;
+
+// CSV columns of node->feature for %f[..] and %F?[..]. The feature is
+// split lazily, at most once per node. Features of dictionaries built
+// with column tables are referred to without copying; the others are
+// parsed by tokenizeCSV into a buffer reused for all the nodes written
+// by one call.
+class FeatureColumns {
+ public:
+  // Returns the number of columns of |node|'s feature.
+  size_t split(const Node *node);
+  // The column is not NUL-terminated.
+  const char *column(size_t i, size_t *length) const {
+    *length = length_[i];
+    return column_[i];
+  }
+
+  explicit FeatureColumns(const Tokenizer<Node, Path> *tokenizer)
+      : tokenizer_(tokenizer), node_(0), size_(0) {}
+
+ private:
+  enum { kMaxColumns = 64 };
+  const Tokenizer<Node, Path> *tokenizer_;
+  const Node *node_;
+  size_t size_;
+  const char *column_[kMaxColumns];
+  size_t length_[kMaxColumns];
+  scoped_array<char> buf_;
+};
+
+// A node format such as "%m\t%H\n", compiled once into a sequence of
+// operations so that the per-node path does not parse the format again.
+// Errors in the format are kept as operations and reported when the
+// node is written, exactly as the interpreted format did.
+class NodeFormat {
+ public:
+  // Compiles |format|. Returns nothing since errors are reported
+  // when a node is written.
+  void compile(const char *format);
+  bool write(Lattice *lattice, const Node *node,
+             StringBuffer *os, FeatureColumns *columns) const;
+  // true if the format has %pp, which shows the paths of a node.
+  bool has_paths() const;
+  // true if the format shows nothing which depends on the whole
+  // sentence: the sentence (%S, %L), the positions (%ps, %pe), the
+  // node ids (%pi, %pp) and the costs from BOS (%pC, %pc, %pn).
+  bool is_streamable() const;
+
+ private:
+  enum {
+    OP_LITERAL, OP_SENTENCE, OP_SENTENCE_LENGTH, OP_SURFACE,
+    OP_SURFACE_WITH_SPACE, OP_POSID, OP_WCOST, OP_FEATURE, OP_CHAR_TYPE,
+    OP_STAT, OP_PROB, OP_ID, OP_SPACE, OP_BEGIN_POS, OP_END_POS,
+    OP_CONNECTION_COST, OP_COST, OP_NODE_COST, OP_ISBEST, OP_ALPHA,
+    OP_BETA, OP_LENGTH, OP_RLENGTH, OP_LCATTR, OP_RCATTR, OP_PATHS,
+    OP_COLUMNS, OP_ERROR
+  };
+
+  struct Op {
+    int type;
+    char mode;                    // %pp[icP]
+    char separator;               // %pp and %F
+    std::string str;              // literal or error message
+    std::vector<size_t> columns;  // %f[..]
+    explicit Op(int t): type(t), mode(0), separator(0) {}
+  };
+
+  std::vector<Op> ops_;
+
+  Op *add_op(int type, std::string *literal);
+  void add_error(const std::string &message, std::string *literal);
+};
+
 class Writer {
  public:
   Writer();
@@ -33,14 +107,46 @@ class Writer {
 
   bool write(Lattice *lattice, StringBuffer *node) const;
 
+  // write() in pieces, for results which are emitted incrementally:
+  // writeBOS() once per sentence, writeNodes() for the nodes
+  // [begin, end) of the best path, and writeEOS() with the EOS node.
+  // Only available when is_streamable().
+  bool writeBOS(Lattice *lattice, StringBuffer *os) const;
+  bool writeNodes(Lattice *lattice, const Node *begin, const Node *end,
+                  StringBuffer *os) const;
+  bool writeEOS(Lattice *lattice, const Node *eos, StringBuffer *os) const;
+  bool is_streamable() const {
+    return write_ != &Writer::writeDump && write_ != &Writer::writeEM &&
+        (write_ != &Writer::writeUser ||
+         (node_format_.is_streamable() && unk_format_.is_streamable() &&
+          bos_format_.is_streamable() && eos_format_.is_streamable()));
+  }
+
+  // true if the output shows the paths between the nodes, which
+  // MECAB_MARGINAL_WITHOUT_PATH does not make.
+  bool needs_paths() const {
+    return write_ == &Writer::writeDump || write_ == &Writer::writeEM ||
+        (write_ == &Writer::writeUser &&
+         (node_format_.has_paths() || unk_format_.has_paths() ||
+          bos_format_.has_paths() || eos_format_.has_paths()));
+  }
+
+  // Features are split with the column tables of the dictionaries
+  // of |tokenizer| when available. ModelImpl::swap() replaces it while
+  // the taggers write, so it is read once per call.
+  void set_tokenizer(const Tokenizer<Node, Path> *tokenizer) {
+    tokenizer_ = tokenizer;
+  }
+
   const char *what() { return what_.str(); }
 
  private:
-  scoped_string node_format_;
-  scoped_string bos_format_;
-  scoped_string eos_format_;
-  scoped_string unk_format_;
-  scoped_string eon_format_;
+  NodeFormat node_format_;
+  NodeFormat bos_format_;
+  NodeFormat eos_format_;
+  NodeFormat unk_format_;
+  NodeFormat eon_format_;
+  const Tokenizer<Node, Path> * volatile tokenizer_;
   whatlog what_;
 
   bool writeLattice(Lattice *lattice, StringBuffer *s) const;
@@ -0,0 +1,222 @@
+// Tests of the library API which the mecab command does not use.
+// The results are compared with the ones of a plain Tagger::parse()
+// of each sentence.
+//
+// Usage: api-test DICDIR FILE
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mecab.h>
+#include "thread.h"
+
+namespace {
+
+#define CHECK(condition) do {                                       \
+    if (!(condition)) {                                             \
+      std::cerr << __FILE__ << "(" << __LINE__ << ") ["             \
+                << #condition << "] " << MeCab::getLastError()      \
+                << std::endl;                                       \
+      return false;                                                 \
+    } } while (0)
+
+bool equal(const std::string &expected, const char *result) {
+  return result && expected == result;
+}
+
+MeCab::Model *create_model(const std::string &dicdir,
+                           const char *options) {
+  const std::string arg = "-r /dev/null -d " + dicdir + " " + options;
+  return MeCab::createModel(arg.c_str());
+}
+
+// The sentences are parsed in batches of 1, 3 and all of them.
+bool check_batch(const std::string &dicdir,
+                 const std::vector<std::string> &sentences,
+                 const std::vector<std::string> &expected) {
+  MeCab::Model *model = create_model(dicdir, "");
+  CHECK(model);
+  MeCab::Tagger *tagger = model->createTagger();
+  CHECK(tagger);
+
+  std::vector<const char *> str;
+  std::vector<size_t> len;
+  for (size_t i = 0; i < sentences.size(); ++i) {
+    str.push_back(sentences[i].c_str());
+    len.push_back(sentences[i].size());
+  }
+
+  bool result = true;
+  const size_t batch_size[] = { 1, 3, sentences.size() };
+  for (size_t k = 0; k < 3 && result; ++k) {
+    const size_t size = batch_size[k];
+    std::vector<const char *> results(size);
+    for (size_t begin = 0; begin < sentences.size() && result;
+         begin += size) {
+      const size_t n = std::min(size, sentences.size() - begin);
+      result = tagger->parseBatch(&str[begin], &len[begin], n, &results[0]);
+      for (size_t i = 0; i < n && result; ++i) {
+        result = equal(expected[begin + i], results[i]);
+      }
+      if (!result) {
+        std::cerr << "batch of " << size << ": " << sentences[begin]
+                  << std::endl;
+      }
+    }
+  }
+
+  delete tagger;
+  delete model;
+  return result;
+}
+
+// Each thread parses every kPoolThreads-th sentence, kPoolRounds times,
+// with the tagger and the lattice of its own slot.
+const size_t kPoolThreads = 4;
+const size_t kPoolRounds = 50;
+
+class PoolThread : public MeCab::thread {
+ public:
+  void run() {
+    MeCab::Tagger *tagger = pool_->tagger(slot_);
+    MeCab::Lattice *lattice = pool_->lattice(slot_);
+    result_ = tagger && lattice;
+    for (size_t k = 0; k < kPoolRounds && result_; ++k) {
+      for (size_t i = slot_; i < sentences_->size() && result_;
+           i += kPoolThreads) {
+        lattice->set_sentence((*sentences_)[i].c_str());
+        result_ = tagger->parse(lattice) &&
+            equal((*expected_)[i], lattice->toString());
+      }
+    }
+  }
+
+  bool result() const { return result_; }
+
+  PoolThread(MeCab::TaggerPool *pool, size_t slot,
+             const std::vector<std::string> *sentences,
+             const std::vector<std::string> *expected)
+      : pool_(pool), slot_(slot), sentences_(sentences),
+        expected_(expected), result_(false) {}
+
+ private:
+  MeCab::TaggerPool *pool_;
+  size_t slot_;
+  const std::vector<std::string> *sentences_;
+  const std::vector<std::string> *expected_;
+  bool result_;
+};
+
+bool check_pool(const std::string &dicdir,
+                const std::vector<std::string> &sentences,
+                const std::vector<std::string> &expected,
+                bool replicate) {
+  MeCab::Model *model = create_model(dicdir, "");
+  CHECK(model);
+  MeCab::TaggerPool *pool = model->createPool(kPoolThreads, replicate);
+  CHECK(pool);
+  CHECK(pool->size() == kPoolThreads);
+
+  std::vector<PoolThread *> threads;
+  for (size_t i = 0; i < kPoolThreads; ++i) {
+    threads.push_back(new PoolThread(pool, i, &sentences, &expected));
+    threads.back()->start();
+  }
+  bool result = true;
+  for (size_t i = 0; i < kPoolThreads; ++i) {
+    threads[i]->join();
+    if (!threads[i]->result()) {
+      std::cerr << "pool slot " << i << (replicate ? " (replicated)" : "")
+                << std::endl;
+      result = false;
+    }
+    delete threads[i];
+  }
+
+  delete pool;
+  delete model;
+  return result;
+}
+
+// A repeated sentence is found in the result cache, and then no
+// lattice is left for formatNode() and next().
+bool check_result_cache(const std::string &dicdir,
+                        const std::vector<std::string> &sentences,
+                        const std::vector<std::string> &expected) {
+  MeCab::Model *model = create_model(dicdir, "-y 16");
+  CHECK(model);
+  MeCab::Tagger *tagger = model->createTagger();
+  CHECK(tagger);
+
+  bool result = true;
+  for (size_t i = 0; i < sentences.size() && result; ++i) {
+    const char *str = sentences[i].c_str();
+    const MeCab::Node *node = tagger->parseToNode(str);
+    result = node && tagger->formatNode(node) &&
+        tagger->parse(str) && equal(expected[i], tagger->parse(str)) &&
+        !tagger->formatNode(node);
+    if (result && tagger->parseNBestInit(str)) {
+      result = tagger->next() &&
+          tagger->parse(str) && equal(expected[i], tagger->parse(str)) &&
+          !tagger->next() && !tagger->nextNode();
+    }
+    if (!result) {
+      std::cerr << "result cache: " << sentences[i] << std::endl;
+    }
+  }
+
+  size_t hits = 0, misses = 0;
+  model->result_cache_stat(&hits, &misses);
+  if (hits == 0) {
+    std::cerr << "result cache: no hits" << std::endl;
+    result = false;
+  }
+
+  delete tagger;
+  delete model;
+  return result;
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " DICDIR FILE" << std::endl;
+    return -1;
+  }
+
+  const std::string dicdir = argv[1];
+  std::vector<std::string> sentences;
+  std::ifstream ifs(argv[2]);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    sentences.push_back(line);
+  }
+
+  MeCab::Model *model = create_model(dicdir, "");
+  if (!model) {
+    std::cerr << MeCab::getLastError() << std::endl;
+    return -1;
+  }
+  MeCab::Tagger *tagger = model->createTagger();
+  std::vector<std::string> expected;
+  for (size_t i = 0; i < sentences.size(); ++i) {
+    const char *result = tagger->parse(sentences[i].c_str());
+    if (!result) {
+      std::cerr << tagger->what() << std::endl;
+      return -1;
+    }
+    expected.push_back(result);
+  }
+  delete tagger;
+  delete model;
+
+  bool result = true;
+  result = check_batch(dicdir, sentences, expected) && result;
+  result = check_pool(dicdir, sentences, expected, false) && result;
+  result = check_pool(dicdir, sentences, expected, true) && result;
+  result = check_result_cache(dicdir, sentences, expected) && result;
+
+  return result ? 0 : 1;
+}
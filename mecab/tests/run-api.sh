@@ -0,0 +1,18 @@
+#!/bin/sh
+
+DIR="shiin t9 latin katakana"
+
+for dir in $DIR
+do
+   (cd $dir;
+   ../../src/mecab-dict-index -f euc-jp -c euc-jp;
+   ../api-test . test;
+   if [ "$?" != "0" ]
+   then
+     echo "runtests faild in $dir"
+     exit 1
+   fi;
+   rm -f *.bin *.dic) || exit 1
+done
+
+exit 0
@@ -2,6 +2,11 @@
 
 DIR="shiin t9 latin katakana autolink chartype ngram"
 
+# options of mecab-dict-index for the other dictionary formats: feature
+# columns, compact double-array, compressed matrix and the bundle. Each
+# must give the same output as the default format.
+FORMATS="-l -k -z -btest.bundle"
+
 for dir in $DIR
 do
    (cd $dir;
@@ -13,7 +18,170 @@ do
      echo "runtests faild in $dir"
      exit -1
    fi;
-   rm -f *.bin *.dic test.out)
+   rm -f *.bin *.dic)
+
+   for format in $FORMATS
+   do
+     (cd $dir;
+     ../../src/mecab-dict-index -f euc-jp -c euc-jp $format;
+     if [ -f test.bundle ]
+     then
+       ../../src/mecab -r /dev/null -d test.bundle test > test.format.out
+     else
+       ../../src/mecab -r /dev/null -d . test > test.format.out
+     fi;
+     diff -b test.out test.format.out;
+     if [ "$?" != "0" ]
+     then
+       echo "runtests faild in $dir with $format"
+       exit 1
+     fi;
+     rm -f *.bin *.dic test.bundle test.format.out) || exit 1
+   done
+
+   rm -f $dir/test.out
 done
 
+# a partial parse of a sentence larger than the trim size (-G) must give
+# the same output as without trimming.
+(cd shiin;
+../../src/mecab-dict-index -f euc-jp -c euc-jp;
+awk 'NR == 1 { for (i = 0; i < 80000; ++i) printf "%s\t*\n", $1; print "EOS" }' \
+  test > test.partial;
+../../src/mecab -r /dev/null -d . -p -b 4000000 test.partial > test.out;
+../../src/mecab -r /dev/null -d . -p -b 4000000 -G 1 test.partial > test.trim.out;
+diff test.out test.trim.out;
+if [ "$?" != "0" ]
+then
+  echo "runtests faild in shiin with -p -G"
+  exit 1
+fi;
+rm -f *.bin *.dic test.partial test.out test.trim.out) || exit 1
+
+# --stream over a line longer than the window (-b) must give the
+# same output as the whole line, or refuse a format which shows
+# positions or costs from BOS.
+for dir in shiin t9 latin katakana
+do
+  (cd $dir;
+  ../../src/mecab-dict-index -f euc-jp -c euc-jp;
+  awk '{ s = s $0 } END { for (i = 0; i < 300; ++i) printf "%s", s; print "" }' \
+    test > test.long;
+  ../../src/mecab -r /dev/null -d . -b 100000 test.long > test.out;
+  ../../src/mecab -r /dev/null -d . -b 8192 --stream test.long > test.stream.out;
+  diff test.out test.stream.out;
+  if [ "$?" != "0" ]
+  then
+    echo "runtests faild in $dir with --stream"
+    exit 1
+  fi;
+  ../../src/mecab -r /dev/null -d . -O "" -F "%m\t%ps\t%pc\n" \
+    -b 100000 test.long > test.out;
+  if ../../src/mecab -r /dev/null -d . -O "" -F "%m\t%ps\t%pc\n" \
+    -b 8192 --stream test.long > test.stream.out 2> /dev/null
+  then
+    diff test.out test.stream.out;
+    if [ "$?" != "0" ]
+    then
+      echo "runtests faild in $dir with --stream and positions"
+      exit 1
+    fi
+  fi;
+  rm -f *.bin *.dic test.long test.out test.stream.out) || exit 1
+done
+
+# --threads over more sentences than one chunk of the workers must
+# give the same output in the same order as a single thread.
+for dir in shiin t9 latin katakana
+do
+  (cd $dir;
+  ../../src/mecab-dict-index -f euc-jp -c euc-jp;
+  awk '{ s[NR] = $0 } END { for (i = 0; i < 150; ++i) for (j = 1; j <= NR; ++j) print s[j] }' \
+    test > test.many;
+  for option in "" "-N 2"
+  do
+    ../../src/mecab -r /dev/null -d . $option test.many > test.out;
+    ../../src/mecab -r /dev/null -d . $option -T 3 test.many > test.threads.out;
+    diff test.out test.threads.out;
+    if [ "$?" != "0" ]
+    then
+      echo "runtests faild in $dir with --threads $option"
+      exit 1
+    fi
+  done;
+  rm -f *.bin *.dic test.many test.out test.threads.out) || exit 1
+done
+
+# --beam. A beam wider than the end nodes at any position prunes
+# nothing and must give the exact output. The narrowest one may
+# change the paths, but must still give one for every sentence.
+for dir in shiin t9 latin katakana
+do
+  (cd $dir;
+  ../../src/mecab-dict-index -f euc-jp -c euc-jp;
+  ../../src/mecab -r /dev/null -d . test > test.out;
+  ../../src/mecab -r /dev/null -d . -W 100000 test > test.beam.out;
+  diff test.out test.beam.out;
+  if [ "$?" != "0" ]
+  then
+    echo "runtests faild in $dir with --beam"
+    exit 1
+  fi;
+  ../../src/mecab -r /dev/null -d . -O "" -W 1 test > test.beam.out;
+  if [ "$?" != "0" ] ||
+     [ `grep -c '' test` != `grep -c '^EOS$' test.beam.out` ]
+  then
+    echo "runtests faild in $dir with --beam 1"
+    exit 1
+  fi;
+  rm -f *.bin *.dic test.out test.beam.out) || exit 1
+done
+
+# the caches must not change the output. The test sentences are
+# repeated, so that they are found in the caches, and the small
+# caches evict them.
+for dir in shiin t9 latin katakana
+do
+  (cd $dir;
+  ../../src/mecab-dict-index -f euc-jp -c euc-jp;
+  awk '{ s[NR] = $0 } END { for (i = 0; i < 20; ++i) for (j = 1; j <= NR; ++j) print s[j] }' \
+    test > test.many;
+  ../../src/mecab -r /dev/null -d . test.many > test.out;
+  ../../src/mecab -r /dev/null -d . -N 2 test.many > test.nbest.out;
+  for option in "-K 4" "-K 1000" "-y 4" "-y 1000" "-y 1000 -N 2"
+  do
+    ../../src/mecab -r /dev/null -d . $option test.many > test.cache.out;
+    case "$option" in
+      *-N*) diff test.nbest.out test.cache.out ;;
+      *) diff test.out test.cache.out ;;
+    esac;
+    if [ "$?" != "0" ]
+    then
+      echo "runtests faild in $dir with $option"
+      exit 1
+    fi
+  done;
+  rm -f *.bin *.dic test.many test.out test.nbest.out test.cache.out) || exit 1
+done
+
+# n-best. Every word of t9 is one character, so there is one
+# segmentation per sentence, and -k must give the 1-best path only.
+(cd t9;
+../../src/mecab-dict-index -f euc-jp -c euc-jp;
+../../src/mecab -r /dev/null -d . -N 5 test > test.out;
+diff test.nbest.gld test.out;
+if [ "$?" != "0" ]
+then
+  echo "runtests faild in t9 with -N"
+  exit 1
+fi;
+../../src/mecab -r /dev/null -d . -N 5 -k test > test.out;
+diff test.gld test.out;
+if [ "$?" != "0" ]
+then
+  echo "runtests faild in t9 with -N -k"
+  exit 1
+fi;
+rm -f *.bin *.dic test.out) || exit 1
+
 exit 0